@@ -0,0 +1,219 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <string_view>
+#include <algorithm>
+#include "../sam/sam.hpp"
+#include "../utils/interval.hpp"
+#include "../utils/quality_utils.hpp"
+
+namespace hc
+{
+
+/**
+ * Per-position evidence of variation over a sliding reference span.
+ *
+ * Every read is scanned once along its CIGAR: aligned bases of sufficient
+ * quality that differ from the reference, inserted and deleted bases and
+ * soft-clip boundaries all count as events at their reference position.
+ * A position's activity is its event count over its read depth; a span
+ * whose positions all stay below the threshold carries no evidence worth
+ * assembling. The span grows as reads extend past its end and shrinks
+ * from the front through drop_before().
+ */
+class ActivityProfile
+{
+public:
+    static constexpr char MIN_BASE_QUALITY = 20 + QualityUtils::ASCII_OFFSET;
+    static constexpr std::size_t MIN_EVENTS = 2;
+    static constexpr double ACTIVE_THRESHOLD = 0.1;
+    // region boundaries treat positions this close to an active one as active,
+    // so a region starts before the first evidence of an event rather than on it
+    static constexpr std::size_t ACTIVITY_SPREAD = 20;
+
+private:
+    std::size_t begin_;
+    std::deque<std::uint32_t> depths;
+    std::deque<std::uint32_t> events;
+
+    void add_event(std::size_t pos)
+    {
+        if (pos >= begin_ && pos - begin_ < events.size())
+            events[pos - begin_]++;
+    }
+
+public:
+    /** Empty profile starting at begin; evidence before begin is ignored. */
+    ActivityProfile(std::size_t begin) : begin_(begin) {}
+
+    /**
+     * Adds one read; ref holds the reference bases starting at ref_begin.
+     * A read whose SEQ or QUAL does not match its CIGAR is ignored.
+     */
+    void add(const SAMRecord& read, std::string_view ref, std::size_t ref_begin)
+    {
+        auto read_length = read.CIGAR.get_read_length();
+        if (read.SEQ.size() != read_length || read.QUAL.size() != read_length) return;
+
+        if (auto end = read.get_alignment_end(); end > this->end())
+        {
+            depths.resize(end - begin_);
+            events.resize(end - begin_);
+        }
+
+        auto pos = read.get_alignment_begin();
+        std::size_t offset = 0;
+        for (auto [length, op] : read.CIGAR)
+        {
+            switch (op)
+            {
+                case CigarOperator::M:
+                case CigarOperator::EQ:
+                case CigarOperator::X:
+                    for (std::size_t i = 0; i < length; i++, pos++, offset++)
+                    {
+                        if (pos < begin_ || pos - begin_ >= depths.size()) continue;
+                        depths[pos - begin_]++;
+                        if (pos < ref_begin || pos - ref_begin >= ref.size()) continue;
+                        if (read.QUAL[offset] >= MIN_BASE_QUALITY && read.SEQ[offset] != ref[pos - ref_begin] && read.SEQ[offset] != 'N')
+                            events[pos - begin_]++;
+                    }
+                    break;
+                case CigarOperator::I:
+                    add_event(pos);
+                    offset += length;
+                    break;
+                case CigarOperator::S:
+                    add_event(pos);
+                    offset += length;
+                    break;
+                case CigarOperator::D:
+                    for (std::size_t i = 0; i < length; i++, pos++)
+                    {
+                        add_event(pos);
+                        if (pos >= begin_ && pos - begin_ < depths.size()) depths[pos - begin_]++;
+                    }
+                    break;
+                case CigarOperator::N:
+                    pos += length;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    /** Forgets every position before pos. */
+    void drop_before(std::size_t pos)
+    {
+        auto n = std::min(pos > begin_ ? pos - begin_ : 0, depths.size());
+        depths.erase(depths.begin(), depths.begin() + n);
+        events.erase(events.begin(), events.begin() + n);
+        begin_ = std::max(begin_, pos);
+    }
+
+    std::size_t begin() const { return begin_; }
+    std::size_t end()   const { return begin_ + depths.size(); }
+
+    /** Events over depth at pos; zero where no read aligns or outside the profile. */
+    double activity(std::size_t pos) const
+    {
+        if (pos < begin() || pos >= end()) return 0;
+        auto i = pos - begin_;
+        if (events[i] < MIN_EVENTS) return 0;
+        return static_cast<double>(events[i]) / std::max<std::uint32_t>(depths[i], events[i]);
+    }
+
+    bool is_active(std::size_t pos) const { return activity(pos) >= ACTIVE_THRESHOLD; }
+
+    /** True if any position of [first, last) is active. */
+    bool is_active(std::size_t first, std::size_t last) const
+    {
+        first = std::max(first, begin());
+        last = std::min(last, end());
+        for (auto pos = first; pos < last; pos++)
+            if (is_active(pos)) return true;
+        return false;
+    }
+
+    struct Region
+    {
+        std::size_t begin, end;
+        bool active;
+    };
+
+    /**
+     * Cuts [first, last) into alternating active and inactive regions.
+     * An active region runs until a quiet stretch of min_size positions
+     * follows it, so nearby events share one region; if activity runs on
+     * past max_size it is cut at the last least-active position that keeps it
+     * at least min_size long. Inactive runs are cut at max_size. Unless
+     * final, the tail shorter than max_size is left for the next call,
+     * whose first should be the end of the last region returned.
+     */
+    std::vector<Region> cut(std::size_t first, std::size_t last, bool final,
+                            std::size_t min_size, std::size_t max_size) const
+    {
+        // active_before[i] counts the active positions in [lo, lo + i), which
+        // turns every range check below into one subtraction
+        auto lo = std::clamp(first > ACTIVITY_SPREAD ? first - ACTIVITY_SPREAD : 0, begin(), end());
+        auto hi = std::clamp(last + std::max(ACTIVITY_SPREAD + 1, min_size), lo, end());
+        std::vector<std::uint32_t> active_before(hi - lo + 1);
+        for (auto pos = lo; pos < hi; pos++)
+            active_before[pos - lo + 1] = active_before[pos - lo] + is_active(pos);
+
+        auto any_active = [&](std::size_t from, std::size_t to){
+            from = std::clamp(from, lo, hi);
+            to = std::clamp(to, from, hi);
+            return active_before[to - lo] != active_before[from - lo];
+        };
+        auto near_active = [&](std::size_t pos){
+            return any_active(pos > ACTIVITY_SPREAD ? pos - ACTIVITY_SPREAD : 0, pos + ACTIVITY_SPREAD + 1);
+        };
+
+        std::vector<Region> regions;
+        auto start = first;
+        while (start < last && (final || last - start >= max_size))
+        {
+            bool active = near_active(start);
+            auto limit = std::min(start + max_size, last);
+            auto stop = start + 1;
+            if (!active)
+                while (stop < limit && !near_active(stop)) stop++;
+            else
+            {
+                std::size_t quiet = 0;
+                for (; stop < limit && quiet < min_size; stop++)
+                    quiet = near_active(stop) ? 0 : quiet + 1;
+                if (quiet == min_size)
+                    stop = std::max(stop - quiet, std::min(start + min_size, last));
+                else if (stop == start + max_size && any_active(stop, stop + min_size))
+                {
+                    stop = start + min_size;
+                    for (auto pos = stop + 1; pos < start + max_size; pos++)
+                        if (activity(pos) <= activity(stop)) stop = pos;
+                }
+            }
+            regions.push_back({start, stop, active});
+            start = stop;
+        }
+        return regions;
+    }
+
+    /**
+     * Padding around [first, last): starts at min_padding on each side and
+     * grows, up to max_padding, while the padded edge sits on an active
+     * position, so that events next to the region keep their context.
+     */
+    std::pair<std::size_t, std::size_t> padding(std::size_t first, std::size_t last,
+                                                std::size_t min_padding, std::size_t max_padding) const
+    {
+        auto left = std::min(min_padding, first), right = min_padding;
+        while (left < std::min(max_padding, first) && is_active(first - left)) left++;
+        while (right < max_padding && is_active(last - 1 + right)) right++;
+        return {left, right};
+    }
+};
+
+} // hc
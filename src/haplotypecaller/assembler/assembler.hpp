@@ -3,9 +3,15 @@
 #include "../utils/quality_utils.hpp"
 #include "../haplotype/haplotype.hpp"
 #include "graph_wrapper.hpp"
-#include "../sam/sam.hpp"
+#include "../sam/clipped_read.hpp"
 #include "../utils/interval.hpp"
+#include "../utils/task_runtime.hpp"
+#include "../utils/region_arena.hpp"
 #include <iostream>
+#include <sstream>
+#include <array>
+#include <atomic>
+#include <memory_resource>
 
 namespace hc
 {
@@ -18,52 +24,111 @@ struct Assembler
     static constexpr std::size_t MAX_UNIQUE_KMERS_COUNT_TO_DISCARD = 2000;
 
 private:
-    std::vector<Haplotype>
-    assemble(const std::vector<SAMRecord>& reads,
+    using ReadSegments = std::pmr::vector<std::string_view>;
+
+    std::ostream& log;
+    std::pmr::memory_resource* resource;
+    TaskRuntime* runtime;
+    bool adaptive_pruning;
+
+    static constexpr std::size_t kmer_size_of(std::size_t iteration)
+    { return INITIAL_KMER_SIZE + iteration * KMER_SIZE_ITERATION_INCREASE; }
+
+    /** One k-mer size; gives up with nothing as soon as cancelled() is true. */
+    template <typename Cancelled>
+    static std::vector<Haplotype>
+    assemble(const ReadSegments& read_segs,
              std::string_view ref,
-             std::size_t kmer_size)
+             std::size_t kmer_size,
+             std::ostream& log,
+             std::pmr::memory_resource* resource,
+             bool adaptive_pruning,
+             Cancelled&& cancelled)
     {
         if (ref.size() < kmer_size) return {};
 
-        GraphWrapper graph(kmer_size);
-        
+        GraphWrapper graph(kmer_size, log, resource);
+
         graph.set_ref(ref);
-        for (const auto& read : reads)
-            graph.set_read(read);
+        graph.set_read_segments(read_segs);
+        graph.set_adaptive_pruning(adaptive_pruning);
 
-        graph.build();
+        graph.build(MAX_UNIQUE_KMERS_COUNT_TO_DISCARD, cancelled);
+        if (cancelled()) return {};
 
         if (graph.unique_kmers_count() > MAX_UNIQUE_KMERS_COUNT_TO_DISCARD)
         {
-            std::cout << "Not using kmer size of " << kmer_size << " in assembler because it contains too much unique kmers\n";
+            log << "Not using kmer size of " << kmer_size << " in assembler because it contains too much unique kmers\n";
             return {};
         }
 
         if (graph.has_cycles())
         {
-            std::cout << "Not using kmer size of " << kmer_size << " in assembler because it contains a cycle\n";
+            log << "Not using kmer size of " << kmer_size << " in assembler because it contains a cycle\n";
             return {};
         }
+        if (cancelled()) return {};
+
+        log << "Using kmer size of " <<  kmer_size << " in assembler\n";
+
+        // graph.print();
 
-        std::cout << "Using kmer size of " <<  kmer_size << " in assembler\n";
-        
-        // graph.print();       
-        
         return graph.find_paths();
     }
 
+    /**
+     * Tries the k-mer sizes after the first as concurrent tasks. The smallest
+     * size that succeeds wins, and larger sizes stop at their next check once
+     * it is known. Only the logs up to the winner are kept, so the log reads
+     * as if the sizes had been tried one after another.
+     */
+    std::vector<Haplotype> assemble_concurrently(const ReadSegments& read_segs, std::string_view ref)
+    {
+        constexpr auto attempts = MAX_KMER_ITERATIONS_TO_ATTEMPT - 1;
+        std::array<std::vector<Haplotype>, attempts> results;
+        std::array<std::string, attempts> logs;
+        std::atomic<std::size_t> winner{attempts};
+
+        runtime->parallel_for(attempts, [&](std::size_t i){
+            auto superseded = [&]{ return winner.load(std::memory_order_relaxed) < i; };
+            if (superseded()) return;
+            // an attempt may run on another thread, so it cannot share the region's arena
+            RegionArena arena;
+            std::ostringstream attempt_log;
+            results[i] = assemble(read_segs, ref, kmer_size_of(i + 1), attempt_log, arena.resource(), adaptive_pruning, superseded);
+            logs[i] = attempt_log.str();
+            if (results[i].empty()) return;
+            auto best = winner.load();
+            while (i < best && !winner.compare_exchange_weak(best, i));
+        });
+
+        auto best = winner.load();
+        for (std::size_t i = 0; i < attempts && i <= best; i++)
+            log << logs[i];
+        return best < attempts ? std::move(results[best]) : std::vector<Haplotype>{};
+    }
+
 public:
-    auto assemble(const std::vector<SAMRecord>& reads, std::string_view ref)
+    /** Given a runtime, the k-mer sizes after the first are tried concurrently. */
+    Assembler(std::ostream& log = std::cout,
+              std::pmr::memory_resource* resource = std::pmr::get_default_resource(),
+              TaskRuntime* runtime = nullptr,
+              bool adaptive_pruning = false)
+        : log(log), resource(resource), runtime(runtime), adaptive_pruning(adaptive_pruning) {}
+
+    auto assemble(const std::vector<ClippedRead>& reads, std::string_view ref)
     {
-        std::size_t iterations = 1;
-        std::size_t kmer_size = INITIAL_KMER_SIZE;
-        auto haplotypes = assemble(reads, ref, kmer_size);
-        while (haplotypes.empty() && iterations < MAX_KMER_ITERATIONS_TO_ATTEMPT)
-        {
-            iterations++;
-            kmer_size += KMER_SIZE_ITERATION_INCREASE;
-            haplotypes = assemble(reads, ref, kmer_size);
-        }
+        auto read_segs = GraphWrapper::read_segments(reads, INITIAL_KMER_SIZE, resource);
+        auto never = []{ return false; };
+
+        // most windows assemble at the first size, and pay nothing for the fan-out
+        auto haplotypes = assemble(read_segs, ref, INITIAL_KMER_SIZE, log, resource, adaptive_pruning, never);
+        if (!haplotypes.empty()) return haplotypes;
+        if (runtime != nullptr && runtime->size() > 0)
+            return assemble_concurrently(read_segs, ref);
+
+        for (std::size_t iteration = 1; haplotypes.empty() && iteration < MAX_KMER_ITERATIONS_TO_ATTEMPT; iteration++)
+            haplotypes = assemble(read_segs, ref, kmer_size_of(iteration), log, resource, adaptive_pruning, never);
         return haplotypes;
     }
 
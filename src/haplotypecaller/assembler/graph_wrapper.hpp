@@ -1,13 +1,22 @@
 #pragma once
 
 #include <string_view>
+#include <string>
 #include <limits>
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/depth_first_search.hpp>
-#include <boost/graph/filtered_graph.hpp>
 #include <vector>
-#include <map>
-#include "../sam/sam.hpp"
+#include <array>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include <stdexcept>
+#include <memory_resource>
+#include <queue>
+#include <unordered_set>
+#include <unordered_map>
+#include <deque>
+#include <numeric>
+#include "kmer.hpp"
+#include "../sam/clipped_read.hpp"
 #include "../haplotype/haplotype.hpp"
 #include <iostream>
 #include <fstream>
@@ -17,217 +26,826 @@
 namespace hc
 {
 
+/**
+ * De Bruijn graph over the reference and read segments of one window.
+ *
+ * K-mers are looked up by their 2-bit packed form in an open-addressing
+ * table; the few with a base other than A, C, G or T, such as an IUPAC code
+ * in the reference, by their bases in a side map. Vertices and edges live
+ * in flat arrays indexed by id; a vertex keeps its out-edges in insertion
+ * order in a fixed array with one slot per A, C, G and T, moving them to
+ * spilled_edges if other bases follow it too, plus its in-degree and the
+ * edge it was first entered by, which is all increase_counts_backwards()
+ * needs.
+ *
+ * While the graph is built, the edges that will be followed whatever else
+ * is added, reference edges and those seen PRUNE_FACTOR times, are kept in
+ * a topological order (Marchetti-Spaccamela et al.): an edge against the
+ * order searches forward from its target, only as far as its source's
+ * position, and either finds a cycle, which stops the build, or moves what
+ * it reached to just after the source. Such a cycle rejects the k-mer
+ * size even if pruning would have removed it later.
+ *
+ * The built graph is then simplified: dangling heads and tails are merged
+ * back into the reference, chains whose support is under PRUNE_FACTOR
+ * (or, with adaptive pruning, a fraction of the coverage around them) are
+ * removed, and so is everything no longer between the source and the sink.
+ * Path search and has_cycles() follow every edge that is left.
+ *
+ * Once simplified, non-branching chains of vertices are collapsed into unitigs,
+ * and cycle detection, path search and haplotype building walk those
+ * instead of single k-mers. A unitig is entered only at its head and left
+ * only from its tail, so a simple path of unitigs spells the same sequence
+ * as the simple path of vertices it stands for; the edges inside a unitig
+ * are the only out-edge of their source and score log10(1) = 0.
+ */
 struct GraphWrapper
 {
     static constexpr std::size_t DEFAULT_NUM_PATHS = 128;
     static constexpr char MIN_BASE_QUALITY_TO_USE = 10 + QualityUtils::ASCII_OFFSET;
     static constexpr std::size_t PRUNE_FACTOR = 2;
+    // with adaptive pruning, a chain also needs this fraction of the largest count next to it
+    static constexpr double ADAPTIVE_PRUNING_FRACTION = 0.01;
+    static constexpr std::size_t MIN_DANGLING_BRANCH_LENGTH = 4;
+    static constexpr std::size_t MAX_DANGLING_INDEL_LENGTH = 10;
+    static constexpr std::size_t MAX_DANGLING_MISMATCHES = 2;
+    // a bubble-rich window stops with the haplotypes found so far once the
+    // path search has queued this many partial paths per unitig
+    static constexpr std::size_t PATH_SEARCH_STEPS_PER_UNITIG = 1024;
 
 private:
-    struct VertexProperty {
+    using Id = std::uint32_t;
+    static constexpr Id NONE = std::numeric_limits<Id>::max();
+    // one out-edge per next A, C, G or T; a vertex with more keeps them all in spilled_edges
+    static constexpr std::size_t INLINE_OUT_DEGREE = 4;
+
+    struct Vertex
+    {
         std::string_view kmer;
+        std::array<Id, INLINE_OUT_DEGREE> out_edges;
+        std::uint32_t out_degree = 0;
+        std::uint32_t in_degree = 0;
+        Id in_edge = NONE;
+        Id spilled = NONE;  // index into spilled_edges, set iff out_degree > INLINE_OUT_DEGREE
     };
 
-    struct EdgeProperty {
+    struct Edge
+    {
+        Id source, target;
         std::size_t count = 0;
         bool is_ref       = false;
         bool is_on_path   = false;
+        bool is_pruned    = false;
         double score      = std::numeric_limits<double>::lowest();
     };
 
-    using Graph = boost::adjacency_list<
-        boost::vecS, boost::vecS, boost::bidirectionalS,
-        VertexProperty, EdgeProperty>;
-    using Vertex = boost::graph_traits<Graph>::vertex_descriptor;
-    using Edge = boost::graph_traits<Graph>::edge_descriptor;
-    using Path = std::vector<Vertex>;
-
-    struct cycle_detector : public boost::dfs_visitor<>
+    /** Whether a k-mer repeats within one sequence, and its shared vertex if it does not. */
+    struct KmerInfo
     {
-        cycle_detector(bool& has_cycle) : _has_cycle(has_cycle) {}
-        template <class Edge, class Graph>
-        void back_edge(Edge, Graph&) {
-            _has_cycle = true;
-        }
-    protected:
-        bool& _has_cycle;
+        std::size_t last_seq = 0;
+        bool is_dup = false;
+        Id vertex = NONE;
     };
 
-    struct EdgeFilter
+    /** A maximal non-branching chain; its edges out are those of its tail. */
+    struct Unitig
     {
-        bool operator()(Edge e) const
-        { return (*g)[e].is_ref || (*g)[e].count >= PRUNE_FACTOR || boost::out_degree(boost::source(e, *g), *g) == 1; }
-        Graph* g;
-    } filter{&g};
+        Id head, tail;
+        std::string_view seq;
+        std::size_t count = 0;  // the largest count among its internal edges
+        bool is_ref = false;
+    };
+
 
     std::size_t kmer_size;
-    Graph g;
-    Vertex source{}, sink{};
-    std::vector<Path> paths;
-    std::set<Vertex> vertices_on_paths;
+    std::ostream& log;
+    std::pmr::memory_resource* resource;
+    std::pmr::vector<Vertex> vertices{resource};
+    std::pmr::vector<Edge> edges{resource};
+    std::pmr::deque<std::pmr::vector<Id>> spilled_edges{resource};
+    KmerTable<KmerInfo> kmers{resource};
+    std::pmr::unordered_map<std::string_view, KmerInfo> ambiguous_kmers{resource};
+    std::size_t unique_kmers = 0;
+    Id source = NONE, sink = NONE;
+    // topological position of each vertex and the vertex at each position, over kept edges
+    std::pmr::vector<Id> order{resource}, by_order{resource};
+    std::pmr::vector<bool> reached{std::pmr::polymorphic_allocator<bool>(resource)};
+    bool has_kept_cycle = false;
+    bool adaptive_pruning = false;
+    // the reference vertices from source to sink, and each vertex's index among them or NONE
+    std::pmr::vector<Id> ref_path{resource}, ref_pos{resource};
+    // bases of the vertices made to merge dangling heads; a deque never moves its strings
+    std::pmr::deque<std::pmr::string> bridges{resource};
+    std::pmr::vector<Unitig> unitigs{resource};
+    std::pmr::vector<Id> unitig_of{resource};
+    std::pmr::string unitig_bases{resource};
+    // set if some vertices lie on a cycle of single in- and out-edges, which no unitig can start
+    bool has_headless_cycle = false;
 
     std::string_view ref;
-    std::vector<std::string_view> read_segs;
+    const std::pmr::vector<std::string_view>* read_segs = nullptr;
 
-    std::set<std::string_view> dup_kmers;
-    std::map<std::string_view, Vertex> unique_kmers;
+    auto out_edges(Id v) const
+    {
+        const auto& vertex = vertices[v];
+        const Id* first = vertex.spilled == NONE ? vertex.out_edges.data() : spilled_edges[vertex.spilled].data();
+        return std::pair(first, first + vertex.out_degree);
+    }
 
-    auto create_edge(Vertex u, Vertex v, bool is_ref)
+    Id find_edge(Id u, Id v) const
     {
-        auto [e, success] = boost::add_edge(u, v, g);
-        g[e].count++;
-        g[e].is_ref = is_ref;
+        for (auto [it, end] = out_edges(u); it != end; ++it)
+            if (edges[*it].target == v) return *it;
+        return NONE;
     }
 
-    auto create_vertex(std::string_view kmer)
+    auto unitig_out_edges(Id u) const
+    { return out_edges(unitigs[u].tail); }
+
+    /** The vertex v's chain continues to, or NONE; the source only starts and the sink only ends a chain. */
+    Id chain_next(Id v) const
     {
-        auto v = boost::add_vertex(g);
-        g[v].kmer = kmer;
-        if (dup_kmers.find(kmer) == dup_kmers.end())
-            unique_kmers.emplace(kmer, v);
-        return v;
+        if (v == sink || vertices[v].out_degree != 1) return NONE;
+        auto w = edges[vertices[v].out_edges[0]].target;
+        return w != source && vertices[w].in_degree == 1 ? w : NONE;
     }
 
-    auto get_vertex(std::string_view kmer)
+    bool is_chain_head(Id v) const
     {
-        if (auto it = unique_kmers.find(kmer); it != unique_kmers.end())
-            return it->second;
-        return create_vertex(kmer);
+        return v == source || vertices[v].in_degree != 1
+            || chain_next(edges[vertices[v].in_edge].source) != v;
     }
 
-    void increase_counts_backwards(Vertex v, std::string_view kmer)
+    /** Followed by path search no matter what is added later. */
+    bool is_kept(Id e) const
     {
-        if (kmer.empty()) return;
-        if (boost::in_degree(v, g) == 1)
+        const auto& edge = edges[e];
+        return edge.is_ref || edge.count >= PRUNE_FACTOR;
+    }
+
+    /** Restores the topological order after e became kept, or flags the cycle e closes. */
+    void keep_edge(Id e)
+    {
+        auto u = edges[e].source, v = edges[e].target;
+        auto lo = order[v], hi = order[u];
+        if (lo > hi) return;
+        if (u == v)
+        {
+            has_kept_cycle = true;
+            return;
+        }
+
+        // everything v reaches over kept edges without going past u's position
+        std::pmr::vector<Id> region(resource);
+        reached.resize(vertices.size());
+        reached[v] = true;
+        region.push_back(v);
+        for (std::size_t i = 0; i < region.size(); i++)
         {
-            for (auto e : boost::make_iterator_range(boost::in_edges(v, g)))
+            for (auto [it, end] = out_edges(region[i]); it != end; ++it)
             {
-                auto u = boost::source(e, g);
-                if (g[u].kmer.back() == kmer.back())
-                {
-                    g[e].count++;
-                    increase_counts_backwards(u, kmer.substr(0, kmer.size()-1));
-                }
+                auto w = edges[*it].target;
+                if (!is_kept(*it) || reached[w] || order[w] > hi) continue;
+                reached[w] = true;
+                region.push_back(w);
+            }
+        }
+        if (reached[u]) has_kept_cycle = true;
+        else
+        {
+            std::sort(region.begin(), region.end(), [this](auto a, auto b){ return order[a] < order[b]; });
+            // the rest of [lo, hi] closes up to the left, keeping its order, and the region goes after it
+            auto next = lo;
+            for (auto i = lo; i <= hi; i++)
+            {
+                auto w = by_order[i];
+                if (reached[w]) continue;
+                order[w] = next;
+                by_order[next++] = w;
+            }
+            for (auto w : region)
+            {
+                order[w] = next;
+                by_order[next++] = w;
             }
         }
+        for (auto w : region) reached[w] = false;
+    }
+
+    void count_edge(Id e)
+    {
+        auto& edge = edges[e];
+        if (++edge.count == PRUNE_FACTOR && !edge.is_ref) keep_edge(e);
     }
 
-    auto extend_chain(Vertex u, std::string_view kmer, bool is_ref)
+    Id add_edge(Id u, Id v, std::size_t count, bool is_ref)
     {
-        for (auto e : boost::make_iterator_range(boost::out_edges(u, g)))
+        auto e = static_cast<Id>(edges.size());
+        auto& edge = edges.emplace_back();
+        edge.source = u;
+        edge.target = v;
+        edge.count = count;
+        edge.is_ref = is_ref;
+        auto& vertex = vertices[u];
+        if (vertex.spilled != NONE)
+            spilled_edges[vertex.spilled].push_back(e);
+        else if (vertex.out_degree == INLINE_OUT_DEGREE)
         {
-            auto v = boost::target(e, g);
-            if (g[v].kmer.back() == kmer.back())
+            vertex.spilled = static_cast<Id>(spilled_edges.size());
+            spilled_edges.emplace_back(vertex.out_edges.begin(), vertex.out_edges.end()).push_back(e);
+        }
+        else vertex.out_edges[vertex.out_degree] = e;
+        vertex.out_degree++;
+        if (vertices[v].in_degree++ == 0) vertices[v].in_edge = e;
+        return e;
+    }
+
+    void create_edge(Id u, Id v, bool is_ref)
+    {
+        auto e = add_edge(u, v, 1, is_ref);
+        if (is_kept(e)) keep_edge(e);
+    }
+
+    std::pair<KmerInfo*, bool> insert_kmer(const KmerScanner& scanner)
+    {
+        if (!scanner.ambiguous()) return kmers.insert(scanner.kmer());
+        auto [it, inserted] = ambiguous_kmers.try_emplace(scanner.view());
+        return {&it->second, inserted};
+    }
+
+    /**
+     * Flags k-mers that occur more than once within seq; such k-mers get a
+     * vertex per occurrence. Every other k-mer will get exactly one vertex,
+     * so unique_kmers is final before a single vertex exists.
+     */
+    void mark_dup_kmers(std::string_view seq, std::size_t seq_id)
+    {
+        for (KmerScanner scanner(seq, kmer_size); scanner.next(); )
+        {
+            auto [info, inserted] = insert_kmer(scanner);
+            if (inserted) unique_kmers++;
+            else if (info->last_seq == seq_id && !info->is_dup)
             {
-                g[e].count++;
-                return v;
+                info->is_dup = true;
+                unique_kmers--;
             }
+            info->last_seq = seq_id;
         }
+    }
+
+    Id get_vertex(const KmerScanner& scanner)
+    {
+        auto info = scanner.ambiguous() ? &ambiguous_kmers.at(scanner.view()) : kmers.find(scanner.kmer());
+        if (info && info->vertex != NONE) return info->vertex;
+
+        auto v = static_cast<Id>(vertices.size());
+        vertices.emplace_back().kmer = scanner.view();
+        order.push_back(v);
+        by_order.push_back(v);
+        if (info && !info->is_dup) info->vertex = v;
+        return v;
+    }
 
-        auto v = get_vertex(kmer);
+    void increase_counts_backwards(Id v, std::string_view kmer)
+    {
+        for (; !kmer.empty() && vertices[v].in_degree == 1; kmer.remove_suffix(1))
+        {
+            auto e = vertices[v].in_edge;
+            if (vertices[edges[e].source].kmer.back() != kmer.back()) return;
+            count_edge(e);
+            v = edges[e].source;
+        }
+    }
+
+    Id extend_chain(Id u, const KmerScanner& scanner, bool is_ref)
+    {
+        auto base = scanner.view().back();
+        for (auto [it, end] = out_edges(u); it != end; ++it)
+        {
+            auto target = edges[*it].target;
+            if (vertices[target].kmer.back() == base)
+            {
+                count_edge(*it);
+                return target;
+            }
+        }
+
+        auto v = get_vertex(scanner);
         create_edge(u, v, is_ref);
         return v;
     }
 
+    /** Stops at the first cycle of kept edges; the graph is then only good for has_cycles(). */
     void add_seq(std::string_view seq, bool is_ref)
     {
-        auto v = get_vertex(seq.substr(0, kmer_size));
+        KmerScanner scanner(seq, kmer_size);
+        if (!scanner.next()) return;
+        auto v = get_vertex(scanner);
         increase_counts_backwards(v, seq.substr(0, kmer_size-1));
         if (is_ref) source = v;
-        for (auto i = 1; i <= seq.size()-kmer_size; i++)
-            v = extend_chain(v, seq.substr(i, kmer_size), is_ref);
+        while (!has_kept_cycle && scanner.next())
+            v = extend_chain(v, scanner, is_ref);
         if (is_ref) sink = v;
     }
 
-    void path_finder(Vertex from, Vertex to, Path& path)
+    /** The bases a walk spells: the first vertex's k-mer, then the last base of each further one. */
+    template <typename It>
+    std::pmr::string spell(It first, It last) const
     {
-        path.push_back(from);
-        if (from == to)
+        std::pmr::string seq(vertices[*first].kmer, resource);
+        while (++first != last)
+            seq += vertices[*first].kmer.back();
+        return seq;
+    }
+
+    void trace_ref_path()
+    {
+        ref_pos.assign(vertices.size(), NONE);
+        for (auto v = source; v != NONE && ref_pos[v] == NONE; )
         {
-            paths.push_back(path);
-            for (auto v : path) vertices_on_paths.insert(v);
+            ref_pos[v] = static_cast<Id>(ref_path.size());
+            ref_path.push_back(v);
+            if (v == sink) break;
+            auto next = NONE;
+            for (auto [it, end] = out_edges(v); it != end; ++it)
+                if (edges[*it].is_ref) next = edges[*it].target;
+            v = next;
         }
-        else
+    }
+
+    /** How a dangling branch lines up with the reference: matched bases, and the differing ones on each side. */
+    struct DanglingMatch
+    {
+        std::size_t matched = 0, alt_diff = 0, ref_diff = 0;
+    };
+
+    /**
+     * Lines alt up with a prefix of ref, both starting with the same
+     * `shared` bases: the longest common suffix over prefix lengths within
+     * MAX_DANGLING_INDEL_LENGTH of alt's, so long as what differs before it
+     * is one substitution of at most MAX_DANGLING_MISMATCHES bases or one
+     * indel. Nothing is matched if no length fits.
+     */
+    template <typename Seq>
+    static DanglingMatch match_dangling(const Seq& alt, const Seq& ref, std::size_t shared)
+    {
+        DanglingMatch best;
+        auto n = alt.size();
+        auto lo = std::max(shared + 1, n > MAX_DANGLING_INDEL_LENGTH ? n - MAX_DANGLING_INDEL_LENGTH : 0);
+        auto hi = std::min(ref.size(), n + MAX_DANGLING_INDEL_LENGTH);
+        for (auto len = lo; len <= hi; len++)
+        {
+            // matched bases stay out of the shared start, so at least one base differs on some side
+            std::size_t m = 0;
+            while (m < n - shared && m < len - shared && alt[n-1-m] == ref[len-1-m]) m++;
+            DanglingMatch match{m, n - shared - m, len - shared - m};
+            auto [matched, a, r] = match;
+            if (matched == 0 || (a != r && std::min(a, r) > 1)) continue;
+            if (a == r)
+            {
+                std::size_t mismatches = 0;
+                for (std::size_t i = 0; i < a; i++)
+                    mismatches += alt[shared+i] != ref[shared+i];
+                if (mismatches > MAX_DANGLING_MISMATCHES) continue;
+            }
+            auto skew = [](const DanglingMatch& x){ return x.alt_diff > x.ref_diff ? x.alt_diff - x.ref_diff : x.ref_diff - x.alt_diff; };
+            if (matched > best.matched || (matched == best.matched && skew(match) < skew(best)))
+                best = match;
+        }
+        return best;
+    }
+
+    /**
+     * A dangling tail is a branch off the reference that ends before
+     * rejoining it, as when reads end within k bases of a variant. Walking
+     * back to the reference, the branch is cut at the first edge seen fewer
+     * than PRUNE_FACTOR times; if its ending bases then match the reference
+     * downstream after one short event, an edge joins the base before them
+     * to the reference vertex they start at.
+     */
+    void recover_dangling_tail(Id t)
+    {
+        std::pmr::vector<Id> alt(resource);
+        auto v = t;
+        while (ref_pos[v] == NONE)
+        {
+            if (vertices[v].in_degree != 1 || vertices[v].out_degree > 1) return;
+            auto e = vertices[v].in_edge;
+            if (edges[e].count < PRUNE_FACTOR) alt.clear();
+            else alt.push_back(v);
+            v = edges[e].source;
+        }
+        alt.push_back(v);
+        if (alt.size() < MIN_DANGLING_BRANCH_LENGTH + 1) return;
+        std::reverse(alt.begin(), alt.end());
+
+        auto n = alt.size() - 1;
+        auto begin = ref_path.begin() + ref_pos[v];
+        auto end = begin + std::min<std::size_t>(n + MAX_DANGLING_INDEL_LENGTH + 1, ref_path.end() - begin);
+        // k-mer of the branch point, then one base per vertex after it
+        auto alt_seq = spell(alt.begin(), alt.end());
+        auto ref_seq = spell(begin, end);
+        auto [matched, alt_diff, ref_diff] = match_dangling(alt_seq, ref_seq, kmer_size);
+        if (matched == 0) return;
+
+        auto u = alt[alt_diff];
+        auto w = begin[ref_diff + 1];
+        if (find_edge(u, w) == NONE)
+            add_edge(u, w, edges[vertices[alt[1]].in_edge].count, false);
+    }
+
+    /**
+     * A dangling head is a branch that joins the reference without leaving
+     * it first, as when reads start within k bases of a variant. It is
+     * walked forward and cut like a tail; if its starting bases match the
+     * reference upstream before one short event, the reference vertex at
+     * their last base gets an edge into the branch at its first differing
+     * base. That base usually lies inside the head's first k-mer, so new
+     * vertices spell the way from the reference to it.
+     */
+    void recover_dangling_head(Id h)
+    {
+        std::pmr::vector<Id> alt(resource);
+        auto v = h;
+        while (ref_pos[v] == NONE)
+        {
+            if (vertices[v].out_degree != 1 || vertices[v].in_degree > 1) return;
+            auto e = vertices[v].out_edges[0];
+            if (edges[e].count < PRUNE_FACTOR) alt.clear();
+            else alt.push_back(v);
+            v = edges[e].target;
+        }
+        alt.push_back(v);
+        if (alt.size() < MIN_DANGLING_BRANCH_LENGTH + 1) return;
+
+        auto n = alt.size() - 1;
+        auto end = ref_path.begin() + ref_pos[v] + 1;
+        auto begin = end - std::min<std::size_t>(n + MAX_DANGLING_INDEL_LENGTH + kmer_size, end - ref_path.begin());
+        // both end at the joining k-mer, so match them reversed
+        auto alt_seq = spell(alt.begin(), alt.end());
+        auto ref_seq = spell(begin, end);
+        auto [matched, alt_diff, ref_diff] = match_dangling(
+            std::pmr::string(alt_seq.rbegin(), alt_seq.rend(), resource),
+            std::pmr::string(ref_seq.rbegin(), ref_seq.rend(), resource), kmer_size);
+        if (matched == 0) return;
+
+        // alt_seq[diverged] is the first base past the match, which ends at ref_seq[ref_end - 1]
+        auto diverged = matched;
+        auto ref_end = ref_seq.size() - kmer_size - ref_diff;
+        if (ref_end < kmer_size) return;
+        auto u = begin[ref_end - kmer_size];
+        auto count = edges[vertices[alt[0]].out_edges[0]].count;
+
+        if (diverged >= kmer_size - 1)
+        {
+            auto w = alt[diverged - (kmer_size - 1)];
+            if (find_edge(u, w) == NONE) add_edge(u, w, count, false);
+            return;
+        }
+        auto& bridge = bridges.emplace_back(ref_seq.substr(ref_end - (kmer_size - 1), kmer_size - 1));
+        bridge += std::string_view(alt_seq).substr(diverged, kmer_size - 1 - diverged);
+        for (std::size_t i = 0; i + kmer_size <= bridge.size(); i++)
+        {
+            auto w = static_cast<Id>(vertices.size());
+            vertices.emplace_back().kmer = std::string_view(bridge).substr(i, kmer_size);
+            ref_pos.push_back(NONE);
+            add_edge(u, w, count, false);
+            u = w;
+        }
+        add_edge(u, alt[0], count, false);
+    }
+
+    void recover_dangling_ends()
+    {
+        auto n = static_cast<Id>(vertices.size());
+        for (Id v = 0; v < n; v++)
+            if (vertices[v].out_degree == 0 && ref_pos[v] == NONE)
+                recover_dangling_tail(v);
+        for (Id v = 0; v < n; v++)
+            if (vertices[v].in_degree == 0 && ref_pos[v] == NONE)
+                recover_dangling_head(v);
+    }
+
+    /** Takes the pruned edges out of the adjacency and recounts in-degrees. */
+    void drop_pruned_edges()
+    {
+        for (auto& vertex : vertices)
+        {
+            auto first = vertex.spilled == NONE ? vertex.out_edges.data() : spilled_edges[vertex.spilled].data();
+            auto last = std::remove_if(first, first + vertex.out_degree, [this](auto e){ return edges[e].is_pruned; });
+            vertex.out_degree = static_cast<std::uint32_t>(last - first);
+            if (vertex.spilled != NONE)
+            {
+                auto& spilled = spilled_edges[vertex.spilled];
+                spilled.resize(vertex.out_degree);
+                if (vertex.out_degree <= INLINE_OUT_DEGREE)
+                {
+                    std::copy(spilled.begin(), spilled.end(), vertex.out_edges.begin());
+                    vertex.spilled = NONE;
+                }
+            }
+            vertex.in_degree = 0;
+            vertex.in_edge = NONE;
+        }
+        for (Id e = 0; e < edges.size(); e++)
+        {
+            const auto& edge = edges[e];
+            if (!edge.is_pruned && vertices[edge.target].in_degree++ == 0)
+                vertices[edge.target].in_edge = e;
+        }
+    }
+
+    /** Prunes every edge that no walk from the source to the sink takes. */
+    void prune_paths_not_connected_to_ref()
+    {
+        std::pmr::vector<bool> from_source(vertices.size(), false, resource), to_sink(vertices.size(), false, resource);
+        std::pmr::vector<Id> stack(resource);
+        from_source[source] = true;
+        stack.push_back(source);
+        while (!stack.empty())
+        {
+            auto v = stack.back();
+            stack.pop_back();
+            for (auto [it, end] = out_edges(v); it != end; ++it)
+            {
+                auto w = edges[*it].target;
+                if (!from_source[w]) stack.push_back(w), from_source[w] = true;
+            }
+        }
+
+        // in-edges are not kept, so gather them by target first
+        std::pmr::vector<Id> first(vertices.size() + 1, 0, resource);
+        for (const auto& edge : edges)
+            if (!edge.is_pruned) first[edge.target + 1]++;
+        std::partial_sum(first.begin(), first.end(), first.begin());
+        std::pmr::vector<Id> next(first.begin(), first.end() - 1, resource);
+        std::pmr::vector<Id> in_sources(first.back(), resource);
+        for (const auto& edge : edges)
+            if (!edge.is_pruned) in_sources[next[edge.target]++] = edge.source;
+
+        to_sink[sink] = true;
+        stack.push_back(sink);
+        while (!stack.empty())
+        {
+            auto v = stack.back();
+            stack.pop_back();
+            for (auto i = first[v]; i < first[v + 1]; i++)
+            {
+                auto u = in_sources[i];
+                if (!to_sink[u]) stack.push_back(u), to_sink[u] = true;
+            }
+        }
+
+        for (auto& edge : edges)
+            if (!from_source[edge.source] || !to_sink[edge.target])
+                edge.is_pruned = true;
+        drop_pruned_edges();
+    }
+
+    /**
+     * Prunes the chains, runs of edges through vertices with one edge in and
+     * one out, that carry no reference edge and no edge seen PRUNE_FACTOR
+     * times, nor with adaptive pruning ADAPTIVE_PRUNING_FRACTION of the
+     * largest count leaving the chain's first vertex or entering its last.
+     */
+    void prune_low_weight_chains()
+    {
+        std::pmr::vector<std::size_t> max_in(vertices.size(), 0, resource);
+        for (const auto& edge : edges)
+            if (!edge.is_pruned) max_in[edge.target] = std::max(max_in[edge.target], edge.count);
+        auto is_middle = [this](Id v){ return vertices[v].in_degree == 1 && vertices[v].out_degree == 1; };
+
+        for (Id u = 0; u < vertices.size(); u++)
         {
-            for (auto e : boost::make_iterator_range(boost::out_edges(from, g)))
+            if (is_middle(u)) continue;
+            std::size_t max_out = 0;
+            for (auto [it, end] = out_edges(u); it != end; ++it)
+                max_out = std::max(max_out, edges[*it].count);
+
+            for (auto [it, end] = out_edges(u); it != end; ++it)
             {
-                if (g[e].is_ref || g[e].count >= PRUNE_FACTOR || boost::out_degree(from, g) == 1)
+                std::size_t support = 0;
+                bool is_ref = false;
+                auto e = *it;
+                for (;;)
                 {
-                    auto v = target(e, g);
-                    if (std::find(path.begin(), path.end(), v) == path.end())
-                        path_finder(v, to, path);
+                    support = std::max(support, edges[e].count);
+                    is_ref |= edges[e].is_ref;
+                    auto w = edges[e].target;
+                    if (!is_middle(w)) break;
+                    e = vertices[w].out_edges[0];
+                }
+
+                auto threshold = static_cast<double>(PRUNE_FACTOR);
+                if (adaptive_pruning)
+                    threshold = std::max(threshold, ADAPTIVE_PRUNING_FRACTION * std::max(max_out, max_in[edges[e].target]));
+                if (is_ref || support >= threshold) continue;
+
+                for (e = *it; ; e = vertices[edges[e].target].out_edges[0])
+                {
+                    edges[e].is_pruned = true;
+                    if (!is_middle(edges[e].target)) break;
                 }
             }
         }
-        path.pop_back();
+        drop_pruned_edges();
     }
 
-    void find_all_paths()
+    void simplify()
     {
-        Path path;
-        path_finder(source, sink, path);
+        if (source == NONE) return;
+        trace_ref_path();
+        recover_dangling_ends();
+        prune_paths_not_connected_to_ref();
+        prune_low_weight_chains();
+        prune_paths_not_connected_to_ref();
     }
 
+    /** Collapses every chain into a unitig, walking each twice: once to size the bases, once to copy them. */
+    void compact()
+    {
+        unitig_of.assign(vertices.size(), NONE);
+        std::size_t bases = 0;
+        for (Id v = 0; v < vertices.size(); v++)
+        {
+            if (!is_chain_head(v)) continue;
+            auto id = static_cast<Id>(unitigs.size());
+            auto& unitig = unitigs.emplace_back();
+            unitig.head = v;
+            bases += kmer_size;
+            unitig_of[v] = id;
+            for (auto w = chain_next(v); w != NONE; w = chain_next(w))
+            {
+                const auto& edge = edges[vertices[v].out_edges[0]];
+                unitig.count = std::max(unitig.count, edge.count);
+                unitig.is_ref |= edge.is_ref;
+                unitig_of[w] = id;
+                bases++;
+                v = w;
+            }
+            unitig.tail = v;
+            v = unitig.head;
+        }
+        has_headless_cycle = std::find(unitig_of.begin(), unitig_of.end(), NONE) != unitig_of.end();
+
+        // reserved up front so the views taken below stay valid
+        unitig_bases.reserve(bases);
+        for (auto& unitig : unitigs)
+        {
+            auto begin = unitig_bases.size();
+            unitig_bases += vertices[unitig.head].kmer;
+            for (auto v = unitig.head; v != unitig.tail; )
+            {
+                v = chain_next(v);
+                unitig_bases += vertices[v].kmer.back();
+            }
+            unitig.seq = std::string_view(unitig_bases).substr(begin);
+        }
+    }
+
+    /**
+     * Marks the followed edges on some path from the source to the sink: those
+     * out of a unitig reachable from the source into one that reaches the
+     * sink. The graph is acyclic by now, so one post-order DFS settles both,
+     * and every such path is simple.
+     */
     void mark_edges_on_paths()
     {
-        for (const auto& path : paths)
+        if (source == NONE) return;
+        enum State : std::uint8_t { UNSEEN, OPEN, REACHES_SINK, DEAD_END };
+        auto from = unitig_of[source], to = unitig_of[sink];
+        std::pmr::vector<State> state(unitigs.size(), UNSEEN, resource);
+        std::pmr::vector<std::pair<Id, std::uint8_t>> stack(resource);
+        state[from] = OPEN;
+        stack.emplace_back(from, 0);
+        while (!stack.empty())
         {
-            auto u = path[0];
-            for (std::size_t i = 1; i < path.size(); i++)
+            auto& [u, next] = stack.back();
+            if (u == to) state[u] = REACHES_SINK;
+            // paths end at the sink, so nothing past it is on one
+            if (u == to || next == vertices[unitigs[u].tail].out_degree)
+            {
+                auto done = u;
+                if (state[done] == OPEN) state[done] = DEAD_END;
+                stack.pop_back();
+                if (!stack.empty() && state[done] == REACHES_SINK)
+                    state[stack.back().first] = REACHES_SINK;
+                continue;
+            }
+            auto e = out_edges(unitigs[u].tail).first[next++];
+            auto w = unitig_of[edges[e].target];
+            if (state[w] == UNSEEN)
             {
-                auto v = path[i];
-                g[boost::edge(u, v, g).first].is_on_path = true;
-                u = v;
+                state[w] = OPEN;
+                stack.emplace_back(w, 0);
             }
+            else if (state[w] == REACHES_SINK)
+                state[u] = REACHES_SINK;
+        }
+
+        for (Id u = 0; u < unitigs.size(); u++)
+        {
+            if (state[u] == UNSEEN || u == to) continue;
+            for (auto [it, end] = unitig_out_edges(u); it != end; ++it)
+                if (state[unitig_of[edges[*it].target]] == REACHES_SINK)
+                    edges[*it].is_on_path = true;
         }
     }
 
+    /** Only edges leaving a tail can branch, so only those need a score. */
     void compute_edges_score()
     {
-        for (auto v : vertices_on_paths)
+        for (Id u = 0; u < unitigs.size(); u++)
         {
-            std::vector<Edge> edges;
-            for (auto e : boost::make_iterator_range(boost::out_edges(v, g)))
-                if (g[e].is_on_path)
-                    edges.push_back(e);
             double sum = 0;
-            for (auto e : edges)
-                sum += g[e].count;
-            for (auto e : edges)
-                g[e].score = std::log10(g[e].count / sum);
+            for (auto [it, end] = unitig_out_edges(u); it != end; ++it)
+                if (edges[*it].is_on_path)
+                    sum += edges[*it].count;
+            for (auto [it, end] = unitig_out_edges(u); it != end; ++it)
+                if (edges[*it].is_on_path)
+                    edges[*it].score = std::log10(edges[*it].count / sum);
         }
     }
 
-    auto get_haplotypes() const
+    /**
+     * The best-scoring paths from the source to the sink, best first, at most
+     * DEFAULT_NUM_PATHS of them and each spelling a different sequence.
+     *
+     * Best-first search over partial paths: scores are sums of log10
+     * fractions, so never grow along a path, and a complete path is popped
+     * only once no partial one can beat it. Only edges on some path to the
+     * sink are taken, so every partial path can complete. Ties go to the
+     * path pushed first. The search stops early once it has queued
+     * PATH_SEARCH_STEPS_PER_UNITIG partial paths per unitig.
+     */
+    auto find_best_paths() const
     {
+        // partial paths share prefixes: each step points back at the one it extends
+        struct Step { Id unitig, parent; };
+        struct Entry
+        {
+            double score;
+            Id step;
+            bool operator<(const Entry& other) const
+            { return score != other.score ? score < other.score : step > other.step; }
+        };
+
         std::vector<Haplotype> haplotypes;
+        // views into the bases below, which never move: no reallocation past the reserve
+        haplotypes.reserve(DEFAULT_NUM_PATHS);
+        std::unordered_set<std::string_view> seen;
+        if (source == NONE) return haplotypes;
+
+        auto to = unitig_of[sink];
+        std::pmr::vector<Step> steps(resource);
+        std::priority_queue<Entry, std::pmr::vector<Entry>> queue{std::less<Entry>{}, std::pmr::vector<Entry>(resource)};
+        std::pmr::vector<Id> path(resource);
+        steps.push_back({unitig_of[source], NONE});
+        queue.push({0, 0});
 
-        for (const auto& path : paths)
+        // a bound on work rather than on time, so the haplotypes do not depend on load or threads
+        auto max_steps = PATH_SEARCH_STEPS_PER_UNITIG * unitigs.size();
+        while (!queue.empty() && haplotypes.size() < DEFAULT_NUM_PATHS)
         {
-            auto u = path[0];
-            std::string seq(g[u].kmer.data(), g[u].kmer.size());
-            double score = 0;
-            for (std::size_t i = 1; i < path.size(); i++)
+            if (steps.size() > max_steps)
             {
-                auto v = path[i];
-                seq += g[v].kmer.back();
-                score += g[boost::edge(u, v, g).first].score;
-                u = v;
+                log << "Path search hit its limit of " << max_steps << " partial paths after " << haplotypes.size() << " haplotypes.\n";
+                break;
             }
-            haplotypes.emplace_back(std::move(seq), score);
-        }
 
-        std::sort(haplotypes.begin(), haplotypes.end(),
-            [](const auto& h1, const auto& h2){
-                return h1.score > h2.score;
-        });
+            auto [score, s] = queue.top();
+            queue.pop();
+            auto u = steps[s].unitig;
+            if (u != to)
+            {
+                for (auto [it, end] = unitig_out_edges(u); it != end; ++it)
+                {
+                    if (!edges[*it].is_on_path) continue;
+                    queue.push({score + edges[*it].score, static_cast<Id>(steps.size())});
+                    steps.push_back({unitig_of[edges[*it].target], s});
+                }
+                continue;
+            }
 
-        if (haplotypes.size() > DEFAULT_NUM_PATHS)
-            haplotypes.erase(haplotypes.begin() + DEFAULT_NUM_PATHS, haplotypes.end());
+            path.clear();
+            for (auto t = s; t != NONE; t = steps[t].parent)
+                path.push_back(steps[t].unitig);
+            std::string seq(unitigs[path.back()].seq);
+            for (auto it = path.rbegin() + 1; it != path.rend(); ++it)
+                seq += unitigs[*it].seq.substr(kmer_size - 1);
+            if (seen.count(seq)) continue;
+            seen.insert(haplotypes.emplace_back(std::move(seq), score).bases);
+        }
+        return haplotypes;
+    }
+
+    auto get_haplotypes() const
+    {
+        auto haplotypes = find_best_paths();
         if (haplotypes.size() > 1)
-            std::cout << "Found " << haplotypes.size() << " candidate haplotypes.\n";
+            log << "Found " << haplotypes.size() << " candidate haplotypes.\n";
         else
-            std::cout << "Found only the reference haplotype in the assembly graph.\n";
+            log << "Found only the reference haplotype in the assembly graph.\n";
 
         IntelSWAligner aligner;
         for (auto& h : haplotypes)
@@ -248,99 +866,161 @@ private:
     }
 
 public:
-    static auto get_dup_kmers(std::string_view seq, std::size_t size)
+    GraphWrapper(std::size_t kmer_size, std::ostream& log = std::cout,
+                 std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : kmer_size(kmer_size), log(log), resource(resource)
     {
-        std::set<std::string_view> all_kmers, dup_kmers;
-        for (std::size_t i = 0; i <= seq.size()-size; i++)
-        {
-            auto kmer = seq.substr(i, size);
-            if (auto [iter, success] = all_kmers.insert(kmer); !success)
-                dup_kmers.insert(kmer);
-        }
-        return dup_kmers;
+        if (kmer_size == 0 || kmer_size > Kmer::MAX_SIZE)
+            throw std::invalid_argument("GraphWrapper: kmer size must lie in [1, " + std::to_string(Kmer::MAX_SIZE) + "]");
     }
 
-    GraphWrapper(std::size_t kmer_size) : kmer_size(kmer_size) {}
-
     void set_ref(std::string_view ref) { this->ref = ref; }
-    void set_read(const SAMRecord& read)
+    /** Usable stretches of the reads, at least min_length long, that every k-mer size up to min_length can share. */
+    static auto read_segments(const std::vector<ClippedRead>& reads, std::size_t min_length,
+                              std::pmr::memory_resource* resource = std::pmr::get_default_resource())
     {
-        auto seq = static_cast<std::string_view>(read.SEQ);
-        const auto& qual = read.QUAL;
-
-        auto start = std::string_view::npos;
-        auto is_usable = [this](auto base, auto qual){ 
-            return base != 'N' && qual >= MIN_BASE_QUALITY_TO_USE; 
+        std::pmr::vector<std::string_view> segs(resource);
+        auto is_usable = [](auto base, auto qual){
+            return base != 'N' && qual >= MIN_BASE_QUALITY_TO_USE;
         };
-        for (std::size_t i = 0; i <= seq.size(); i++)
+        for (const auto& read : reads)
         {
-            if (i == seq.size() || !is_usable(seq[i], qual[i]))
+            auto seq = read.seq();
+            auto qual = read.qual();
+            auto start = std::string_view::npos;
+            for (std::size_t i = 0; i <= seq.size(); i++)
             {
-                if (start != std::string_view::npos && i-start >= kmer_size)
-                    read_segs.push_back(seq.substr(start, i-start));
-                start = std::string_view::npos;
+                if (i == seq.size() || !is_usable(seq[i], qual[i]))
+                {
+                    if (start != std::string_view::npos && i-start >= min_length)
+                        segs.push_back(seq.substr(start, i-start));
+                    start = std::string_view::npos;
+                }
+                else if (start == std::string_view::npos)
+                    start = i;
             }
-            else if (start == std::string_view::npos)
-                start = i;
         }
+        return segs;
     }
 
-    void build()
+    /** Segments shorter than the k-mer size are skipped; segs must outlive the graph. */
+    void set_read_segments(const std::pmr::vector<std::string_view>& segs) { read_segs = &segs; }
+
+    /** Lets the pruning threshold of a chain rise with the coverage around it. */
+    void set_adaptive_pruning(bool on) { adaptive_pruning = on; }
+
+    /**
+     * Builds the graph, unless it would hold more than max_unique_kmers
+     * unique k-mers, which is known before any vertex is made, and stops as
+     * soon as kept edges close a cycle. Either way the graph is then only
+     * good for unique_kmers_count() and has_cycles(). cancelled() is checked
+     * between sequences; once it is true the graph is good for nothing.
+     */
+    template <typename Cancelled>
+    void build(std::size_t max_unique_kmers, Cancelled&& cancelled)
     {
-        for (auto kmer : get_dup_kmers(ref, kmer_size))
-            dup_kmers.insert(kmer);
+        std::pmr::vector<std::string_view> segs(resource);
+        if (read_segs)
+            std::copy_if(read_segs->begin(), read_segs->end(), std::back_inserter(segs),
+                [this](auto seg){ return seg.size() >= kmer_size; });
+
+        mark_dup_kmers(ref, 0);
+        for (std::size_t i = 0; i < segs.size() && !cancelled(); i++)
+            mark_dup_kmers(segs[i], i + 1);
+        if (unique_kmers > max_unique_kmers || cancelled()) return;
 
-        for (auto seg : read_segs)
-            for (auto kmer : get_dup_kmers(seg, kmer_size))
-                dup_kmers.insert(kmer);
+        // deep coverage repeats k-mers many times over, so size by distinct k-mers, not occurrences
+        vertices.reserve(kmers.size());
+        edges.reserve(kmers.size());
+        order.reserve(kmers.size());
+        by_order.reserve(kmers.size());
 
         add_seq(ref, true);
-        for (auto seg : read_segs)
-            add_seq(seg, false);
+        for (std::size_t i = 0; i < segs.size() && !has_kept_cycle && !cancelled(); i++)
+            add_seq(segs[i], false);
+
+        if (has_kept_cycle || cancelled()) return;
+        simplify();
+        compact();
     }
 
+    void build(std::size_t max_unique_kmers = std::numeric_limits<std::size_t>::max())
+    { build(max_unique_kmers, []{ return false; }); }
+
+    /** True if the edges path search follows form a cycle; iterative three-colour DFS from every unitig. */
     bool has_cycles() const
     {
-        bool has_cycle = false;
-        cycle_detector vis(has_cycle);
-        boost::filtered_graph<Graph, EdgeFilter> fg(g, filter);
-        boost::depth_first_search(fg, boost::visitor(vis));
-        return has_cycle;
+        if (has_kept_cycle || has_headless_cycle) return true;
+
+        enum Colour : std::uint8_t { WHITE, GREY, BLACK };
+        std::pmr::vector<Colour> colour(unitigs.size(), WHITE, resource);
+        std::pmr::vector<std::pair<Id, std::uint8_t>> stack(resource);
+        for (Id root = 0; root < unitigs.size(); root++)
+        {
+            if (colour[root] != WHITE) continue;
+            colour[root] = GREY;
+            stack.emplace_back(root, 0);
+            while (!stack.empty())
+            {
+                auto& [v, next] = stack.back();
+                const auto& tail = vertices[unitigs[v].tail];
+                if (next == tail.out_degree)
+                {
+                    colour[v] = BLACK;
+                    stack.pop_back();
+                    continue;
+                }
+                auto e = out_edges(unitigs[v].tail).first[next++];
+                auto w = unitig_of[edges[e].target];
+                if (colour[w] == GREY) return true;
+                if (colour[w] == WHITE)
+                {
+                    colour[w] = GREY;
+                    stack.emplace_back(w, 0);
+                }
+            }
+        }
+        return false;
     }
 
     auto unique_kmers_count() const
-    { return unique_kmers.size(); }
+    { return unique_kmers; }
 
+    /** Must follow a has_cycles() that came back false. */
     auto find_paths()
     {
-        find_all_paths();
         mark_edges_on_paths();
         compute_edges_score();
         return get_haplotypes();
     }
 
+    /** Writes the compacted graph; a unitig is labelled with its bases and the largest count inside it. */
     void print() const
     {
         std::ofstream os("graph.dot");
         os << "digraph assembly_graphs {";
-        for (auto e : boost::make_iterator_range(boost::edges(g)))
+        for (Id u = 0; u < unitigs.size(); u++)
         {
-            os << boost::source(e, g) << " -> " << boost::target(e, g) << " ";
-            auto count = g[e].count;
-            if (g[e].is_ref)
-                os << "[label=" << count << ",color=red];\n";
-            else if (count < PRUNE_FACTOR)
-                os << "[label=" << count << ",style=dotted,color=grey];\n";
-            else os << "[label=" << count << "];\n";
+            for (auto [it, end] = unitig_out_edges(u); it != end; ++it)
+            {
+                const auto& edge = edges[*it];
+                os << u << " -> " << unitig_of[edge.target] << " ";
+                auto count = edge.count;
+                if (edge.is_ref)
+                    os << "[label=" << count << ",color=red];\n";
+                else if (count < PRUNE_FACTOR)
+                    os << "[label=" << count << ",style=dotted,color=grey];\n";
+                else os << "[label=" << count << "];\n";
+            }
         }
 
-        for (auto v : boost::make_iterator_range(boost::vertices(g)))
+        for (Id u = 0; u < unitigs.size(); u++)
         {
-            os << v << " ";
-            auto kmer = g[v].kmer;
-            if (boost::in_degree(v, g) == 0)
-                os << "[label=" << kmer << ",shape=box]\n";
-            else os << "[label=" << kmer.back() << ",shape=box]\n";
+            const auto& unitig = unitigs[u];
+            auto seq = vertices[unitig.head].in_degree == 0 ? unitig.seq : unitig.seq.substr(kmer_size - 1);
+            os << u << " [label=\"" << seq << "\\n" << unitig.count << "\",shape=box";
+            if (unitig.is_ref) os << ",color=red";
+            os << "]\n";
         }
         os << "}";
     }
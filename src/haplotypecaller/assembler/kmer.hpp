@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+#include <utility>
+#include <algorithm>
+
+namespace hc
+{
+
+/** A k-mer of up to MAX_SIZE bases packed two bits per base; word 0 holds the last 32 bases. */
+struct Kmer
+{
+    static constexpr std::size_t MAX_SIZE = 128;
+    static constexpr std::size_t WORDS = MAX_SIZE / 32;
+    // A, C, G and T map to 0-3; every other byte is AMBIGUOUS
+    static constexpr std::uint8_t AMBIGUOUS = 4;
+
+    static constexpr auto CODES = []{
+        std::array<std::uint8_t, 256> codes{};
+        for (auto& code : codes) code = AMBIGUOUS;
+        codes['A'] = 0; codes['C'] = 1; codes['G'] = 2; codes['T'] = 3;
+        return codes;
+    }();
+
+    static std::uint8_t code(char base) { return CODES[static_cast<std::uint8_t>(base)]; }
+
+    std::array<std::uint64_t, WORDS> words{};
+
+    bool operator==(const Kmer& other) const { return words == other.words; }
+
+    std::size_t hash() const
+    {
+        std::uint64_t h = 0x9e3779b97f4a7c15;
+        for (auto word : words)
+        {
+            h ^= word + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+            h *= 0xbf58476d1ce4e5b9;
+        }
+        return h ^ (h >> 31);
+    }
+};
+
+/**
+ * Walks the k-mers of a sequence, updating the packed form by one shift per
+ * base instead of re-encoding all k bases. A k-mer containing a base other
+ * than A, C, G or T is reported as ambiguous; its packed form is unusable.
+ */
+class KmerScanner
+{
+    std::string_view seq;
+    std::size_t k;
+    std::size_t pos = 0;
+    std::size_t last_ambiguous = 0;  // one past the most recent ambiguous base
+    std::array<std::uint64_t, Kmer::WORDS> mask{};
+    Kmer kmer_;
+
+    void push(char base)
+    {
+        auto code = Kmer::code(base);
+        if (code == Kmer::AMBIGUOUS)
+        {
+            last_ambiguous = pos + 1;
+            code = 0;
+        }
+        for (auto i = Kmer::WORDS - 1; i > 0; i--)
+            kmer_.words[i] = ((kmer_.words[i] << 2) | (kmer_.words[i-1] >> 62)) & mask[i];
+        kmer_.words[0] = ((kmer_.words[0] << 2) | code) & mask[0];
+        pos++;
+    }
+
+public:
+    /** k must lie in [1, Kmer::MAX_SIZE]. */
+    KmerScanner(std::string_view seq, std::size_t k) : seq(seq), k(k)
+    {
+        for (std::size_t i = 0, bits = 2 * k; i < Kmer::WORDS && bits > 0; i++)
+        {
+            mask[i] = bits >= 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << bits) - 1;
+            bits -= std::min<std::size_t>(bits, 64);
+        }
+        while (pos + 1 < k && pos < seq.size())
+            push(seq[pos]);
+    }
+
+    /** Moves to the next k-mer; false once the sequence is exhausted. */
+    bool next()
+    {
+        if (pos >= seq.size()) return false;
+        push(seq[pos]);
+        return true;
+    }
+
+    const Kmer& kmer() const { return kmer_; }
+    std::size_t begin() const { return pos - k; }
+    std::string_view view() const { return seq.substr(begin(), k); }
+    bool ambiguous() const { return last_ambiguous > begin(); }
+};
+
+/** Open-addressing hash map from Kmer to Value, linear probing, at most half full. */
+template <typename Value>
+class KmerTable
+{
+    struct Slot
+    {
+        Kmer kmer;
+        Value value{};
+        bool used = false;
+    };
+
+    std::pmr::vector<Slot> slots;
+    std::size_t count = 0;
+
+    std::size_t probe(const Kmer& kmer) const
+    {
+        auto mask = slots.size() - 1;
+        auto i = kmer.hash() & mask;
+        while (slots[i].used && !(slots[i].kmer == kmer))
+            i = (i + 1) & mask;
+        return i;
+    }
+
+    void grow()
+    {
+        std::pmr::vector<Slot> old(slots.size() * 2, slots.get_allocator());
+        old.swap(slots);
+        for (auto& slot : old)
+            if (slot.used) slots[probe(slot.kmer)] = std::move(slot);
+    }
+
+public:
+    KmerTable(std::pmr::memory_resource* resource = std::pmr::get_default_resource(), std::size_t capacity = 1024)
+        : slots(capacity, resource) {}
+
+    std::size_t size() const { return count; }
+
+    /** Makes room for n k-mers without further growth. */
+    void reserve(std::size_t n)
+    {
+        while (2 * n > slots.size()) grow();
+    }
+
+    Value* find(const Kmer& kmer)
+    {
+        auto& slot = slots[probe(kmer)];
+        return slot.used ? &slot.value : nullptr;
+    }
+
+    /** The value of kmer, default-constructed if new, and whether it was inserted. */
+    std::pair<Value*, bool> insert(const Kmer& kmer)
+    {
+        if (2 * (count + 1) > slots.size()) grow();
+        auto& slot = slots[probe(kmer)];
+        if (slot.used) return {&slot.value, false};
+        slot.kmer = kmer;
+        slot.used = true;
+        count++;
+        return {&slot.value, true};
+    }
+};
+
+} // hc
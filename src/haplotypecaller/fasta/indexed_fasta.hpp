@@ -0,0 +1,205 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+#include <sys/mman.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include "../utils/mapped_file.hpp"
+
+namespace hc
+{
+
+/**
+ * Random access to a multi-contig FASTA through its .fai index.
+ *
+ * The FASTA is memory-mapped; if no "<path>.fai" exists the index is built
+ * by one scan over the mapping. A contig is decoded the first time it is
+ * requested: its lines are copied out of the mapping without line breaks
+ * and uppercased on the way, then served as string_view slices until
+ * release() drops it. Nothing else of the file ever reaches the heap.
+ */
+class IndexedFasta
+{
+public:
+    /** One line of a .fai index. */
+    struct Entry
+    {
+        std::string name;
+        std::size_t length = 0;
+        std::size_t offset = 0;
+        std::size_t line_bases = 0;
+        std::size_t line_width = 0;
+    };
+
+private:
+    MappedFile file;
+    std::vector<Entry> entries;
+    std::unordered_map<std::string, std::size_t> ids;
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<std::string>> decoded;
+
+    static bool is_space(char c)
+    { return c == ' ' || c == '\t' || c == '\v' || c == '\f' || c == '\r'; }
+
+    void load_index(std::istream& is)
+    {
+        std::string line;
+        while (std::getline(is, line))
+        {
+            if (line.empty()) continue;
+            std::istringstream fields(line);
+            Entry entry;
+            if (!std::getline(fields, entry.name, '\t')
+             || !(fields >> entry.length >> entry.offset >> entry.line_bases >> entry.line_width))
+                throw std::runtime_error("IndexedFasta: malformed index line: " + line);
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    /** Builds the index like samtools faidx: every line but the last of a record must have the same width. */
+    void build_index()
+    {
+        auto data = file.view();
+        std::size_t pos = 0;
+        while (pos < data.size())
+        {
+            auto eol = std::min(data.find('\n', pos), data.size());
+            if (data[pos] != '>')
+            {
+                if (eol == pos || (eol == pos + 1 && data[pos] == '\r')) { pos = eol + 1; continue; }
+                throw std::runtime_error("IndexedFasta: expected '>'");
+            }
+
+            Entry entry;
+            auto header = data.substr(pos + 1, eol - pos - 1);
+            entry.name = header.substr(0, std::find_if(header.begin(), header.end(), is_space) - header.begin());
+            entry.offset = std::min(eol + 1, data.size());
+
+            pos = entry.offset;
+            bool short_line_seen = false;
+            while (pos < data.size() && data[pos] != '>')
+            {
+                auto end = std::min(data.find('\n', pos), data.size());
+                auto width = end - pos + (end < data.size());
+                auto bases = end - pos - (end > pos && data[end-1] == '\r');
+                if (bases > 0)
+                {
+                    if (entry.line_width == 0)
+                    {
+                        entry.line_width = width;
+                        entry.line_bases = bases;
+                    }
+                    if (short_line_seen || bases > entry.line_bases)
+                        throw std::runtime_error("IndexedFasta: " + entry.name + " has lines of different length");
+                    short_line_seen = bases < entry.line_bases;
+                    entry.length += bases;
+                }
+                pos = end + 1;
+            }
+            entries.push_back(std::move(entry));
+        }
+    }
+
+    /** Copies n bytes from src to dst, mapping 'a'-'z' to upper case. */
+    static void copy_upper(const char* src, std::size_t n, char* dst)
+    {
+        std::size_t i = 0;
+#ifdef __AVX2__
+        const auto a = _mm256_set1_epi8('a' - 1), z = _mm256_set1_epi8('z' + 1), bit = _mm256_set1_epi8(0x20);
+        for (; i + 32 <= n; i += 32)
+        {
+            auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            auto lower = _mm256_and_si256(_mm256_cmpgt_epi8(v, a), _mm256_cmpgt_epi8(z, v));
+            v = _mm256_xor_si256(v, _mm256_and_si256(lower, bit));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), v);
+        }
+#endif
+        for (; i < n; i++)
+            dst[i] = src[i] >= 'a' && src[i] <= 'z' ? src[i] - 0x20 : src[i];
+    }
+
+    std::unique_ptr<std::string> decode(const Entry& entry) const
+    {
+        auto seq = std::make_unique<std::string>(entry.length, '\0');
+        if (entry.length == 0) return seq;
+        auto lines = (entry.length + entry.line_bases - 1) / entry.line_bases;
+        if (entry.offset + (lines - 1) * entry.line_width + (entry.length - (lines - 1) * entry.line_bases) > file.size())
+            throw std::runtime_error("IndexedFasta: index does not match the FASTA for " + entry.name);
+
+        file.advise(MADV_SEQUENTIAL, entry.offset, std::min(lines * entry.line_width, file.size() - entry.offset));
+        for (std::size_t line = 0, copied = 0; copied < entry.length; line++)
+        {
+            auto n = std::min(entry.line_bases, entry.length - copied);
+            copy_upper(file.data() + entry.offset + line * entry.line_width, n, seq->data() + copied);
+            copied += n;
+        }
+        return seq;
+    }
+
+public:
+    IndexedFasta(const std::string& path) : file(path)
+    {
+        if (std::ifstream fai(path + ".fai"); fai)
+            load_index(fai);
+        else
+            build_index();
+
+        for (std::size_t i = 0; i < entries.size(); i++)
+            ids.emplace(entries[i].name, i);
+        decoded.resize(entries.size());
+    }
+
+    /** Contigs in file order, which is the reference dictionary order. */
+    const std::vector<Entry>& contigs() const { return entries; }
+
+    bool contains(const std::string& contig) const { return ids.count(contig) != 0; }
+
+    /** Position of contig in contigs(). */
+    std::size_t id(const std::string& contig) const
+    {
+        auto it = ids.find(contig);
+        if (it == ids.end())
+            throw std::invalid_argument("IndexedFasta: contig " + contig + " not in reference");
+        return it->second;
+    }
+
+    std::size_t length(const std::string& contig) const { return entries[id(contig)].length; }
+
+    /** The whole contig, uppercased; valid until release(contig). */
+    std::string_view get(const std::string& contig)
+    {
+        auto i = id(contig);
+        std::lock_guard lock(mutex);
+        if (!decoded[i]) decoded[i] = decode(entries[i]);
+        return *decoded[i];
+    }
+
+    /** Bases [begin, end) of contig, clamped to its length. */
+    std::string_view get(const std::string& contig, std::size_t begin, std::size_t end)
+    {
+        auto seq = get(contig);
+        begin = std::min(begin, seq.size());
+        return seq.substr(begin, std::min(end, seq.size()) - begin);
+    }
+
+    /** Frees the decoded copy of contig. */
+    void release(const std::string& contig)
+    {
+        auto i = id(contig);
+        std::lock_guard lock(mutex);
+        decoded[i].reset();
+    }
+};
+
+} // hc
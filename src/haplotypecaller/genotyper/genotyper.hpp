@@ -1,10 +1,12 @@
 #pragma once
 
-#include "../sam/sam.hpp"
+#include "../sam/clipped_read.hpp"
 #include "../haplotype/haplotype.hpp"
 #include "../utils/interval.hpp"
 #include "../utils/math_utils.hpp"
 #include <set>
+#include <map>
+#include <memory_resource>
 #include <numeric>
 
 namespace hc
@@ -19,6 +21,8 @@ class Genetyper
     static constexpr std::size_t MAX_ALLELE_COUNT = 7;
 
 private:
+    std::pmr::memory_resource* resource;
+
     static const inline auto allele_index_cache = []{
         std::vector<std::vector<std::pair<std::size_t, std::size_t>>> cache{};
         for (std::size_t allele_count = 0; allele_count <= MAX_ALLELE_COUNT; allele_count++)
@@ -114,7 +118,7 @@ private:
                                    std::string_view ref,
                                    const Interval& padded_region)
     {
-        std::set<std::size_t> events_begins;
+        std::pmr::set<std::size_t> events_begins(resource);
         std::size_t rank = 0;
         for (auto& h : haplotypes)
         {
@@ -196,7 +200,7 @@ private:
                               std::size_t begin,
                               const std::vector<Haplotype>& haplotypes)
     {
-        std::map<std::size_t, std::vector<std::size_t>> result;
+        std::pmr::map<std::size_t, std::pmr::vector<std::size_t>> result(resource);
         result[0];
         const auto& ref_allele = alleles[0];
         auto get_index = [&](const auto& allele){
@@ -221,7 +225,7 @@ private:
         return result;
     }
 
-    auto get_haplotype_mapper(const std::map<std::size_t, std::vector<std::size_t>>& allele_mapper,
+    auto get_haplotype_mapper(const std::pmr::map<std::size_t, std::pmr::vector<std::size_t>>& allele_mapper,
                               std::size_t haplotype_count)
     {
         std::vector<std::size_t> haplotype_mapper(haplotype_count);
@@ -231,7 +235,7 @@ private:
         return haplotype_mapper;
     }
 
-    auto get_read_indices_to_keep(const std::vector<SAMRecord>& reads,
+    auto get_read_indices_to_keep(const std::vector<ClippedRead>& reads,
                                   const Interval& overlap)
     {
         std::vector<std::size_t> read_indices_to_keep;
@@ -245,10 +249,10 @@ private:
     auto marginal_likelihoods(std::size_t allele_count,
                               const std::vector<std::size_t>& haplotype_mapper,
                               const std::vector<std::size_t>& read_indices_to_keep,
-                              const std::vector<std::vector<double>>& haplotype_likelihoods)
+                              const LikelihoodMatrix& haplotype_likelihoods)
     {
-        std::vector<std::vector<double>> allele_likelihoods(read_indices_to_keep.size(),
-            std::vector<double>(allele_count, std::numeric_limits<double>::lowest()));
+        LikelihoodMatrix allele_likelihoods(read_indices_to_keep.size(),
+            std::pmr::vector<double>(allele_count, std::numeric_limits<double>::lowest(), resource), resource);
         for (std::size_t r = 0; r < read_indices_to_keep.size(); r++)
         {
             auto old_read_index = read_indices_to_keep[r];
@@ -265,16 +269,16 @@ private:
 
     auto marginalize(const std::vector<std::size_t>& haplotype_mapper,
                      std::size_t allele_count,
-                     const std::vector<SAMRecord>& reads,
-                     const std::vector<std::vector<double>>& haplotype_likelihoods,
+                     const std::vector<ClippedRead>& reads,
+                     const LikelihoodMatrix& haplotype_likelihoods,
                      const Interval& overlap)
     {
         auto read_indices_to_keep = get_read_indices_to_keep(reads, overlap);
         return marginal_likelihoods(allele_count, haplotype_mapper, read_indices_to_keep, haplotype_likelihoods);
     }
 
-    void single_component_genotype_likelihood_by_read(std::vector<double>& genotype_likelihoods,
-                                                      const std::vector<std::vector<double>>& allele_likelihoods,
+    void single_component_genotype_likelihood_by_read(std::pmr::vector<double>& genotype_likelihoods,
+                                                      const LikelihoodMatrix& allele_likelihoods,
                                                       std::size_t a)
     {
         const auto log10_frequency = std::log10(2);
@@ -282,8 +286,8 @@ private:
             [=](const auto& likelihoods){ return likelihoods[a] + log10_frequency; });
     }
 
-    void two_component_genotype_likelihood_by_read(std::vector<double>& genotype_likelihoods,
-                                                   const std::vector<std::vector<double>>& allele_likelihoods,
+    void two_component_genotype_likelihood_by_read(std::pmr::vector<double>& genotype_likelihoods,
+                                                   const LikelihoodMatrix& allele_likelihoods,
                                                    std::size_t a1,
                                                    std::size_t a2)
     {
@@ -291,10 +295,10 @@ private:
             [=](const auto& likelihoods){ return MathUtils::approximate_log10_sum_log10(likelihoods[a1], likelihoods[a2]); });
     }
 
-    auto calculate_read_likelihoods_by_genotype_index(const std::vector<std::vector<double>>& allele_likelihoods,
+    auto calculate_read_likelihoods_by_genotype_index(const LikelihoodMatrix& allele_likelihoods,
                                                       std::size_t allele_count)
     {
-        std::vector<std::vector<double>> read_likelihoods_by_genotype_index((allele_count + 1) * allele_count / 2);
+        LikelihoodMatrix read_likelihoods_by_genotype_index((allele_count + 1) * allele_count / 2, resource);
         std::size_t cur_genotype_index = 0;
         for (std::size_t a1 = 0; a1 < allele_count; a1++)
         {
@@ -309,7 +313,7 @@ private:
         return read_likelihoods_by_genotype_index;
     }
 
-    auto get_genotype_likelihoods(const std::vector<std::vector<double>>& read_likelihoods_by_genotype_index)
+    auto get_genotype_likelihoods(const LikelihoodMatrix& read_likelihoods_by_genotype_index)
     {
         const auto genotype_count = read_likelihoods_by_genotype_index.size();
         std::vector<double> result(genotype_count);
@@ -320,7 +324,7 @@ private:
         return result;
     }
 
-    auto calculate_genotype_likelihoods(const std::vector<std::vector<double>>& allele_likelihoods,
+    auto calculate_genotype_likelihoods(const LikelihoodMatrix& allele_likelihoods,
                                         std::size_t allele_count)
     {
         auto read_likelihoods_by_genotype_index = calculate_read_likelihoods_by_genotype_index(allele_likelihoods, allele_count);
@@ -366,9 +370,11 @@ private:
     { return allele_index_cache[allele_count][genotype_index]; }
 
 public:
-    auto assign_genotype_likelihoods(const std::vector<SAMRecord>& reads,
+    Genetyper(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) : resource(resource) {}
+
+    auto assign_genotype_likelihoods(const std::vector<ClippedRead>& reads,
                                      std::vector<Haplotype>& haplotypes,
-                                     const std::vector<std::vector<double>>& haplotype_likelihoods,
+                                     const LikelihoodMatrix& haplotype_likelihoods,
                                      std::string_view ref,
                                      const Interval& padded_region,
                                      const Interval& origin_region)
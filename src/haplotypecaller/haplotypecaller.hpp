@@ -4,12 +4,23 @@
 #include <fstream>
 #include <vector>
 #include <string>
+#include <memory>
 #include <sstream>
-#include <random>
+#include <deque>
+#include <thread>
+#include <future>
+#include <iomanip>
+#include <limits>
 #include "sam/sam.hpp"
-#include "fasta/fasta.hpp"
+#include "sam/read_buffer.hpp"
+#include "fasta/indexed_fasta.hpp"
 #include "utils/interval.hpp"
+#include "utils/interval_utils.hpp"
 #include "utils/read_filter.hpp"
+#include "utils/task_runtime.hpp"
+#include "utils/region_arena.hpp"
+#include "utils/positional_downsampler.hpp"
+#include "activity/activity_profile.hpp"
 #include "assembler/assembler.hpp"
 #include "utils/read_clipper.hpp"
 #include "pairhmm/intel_pairhmm.hpp"
@@ -21,81 +32,38 @@ namespace hc
 class HaplotypeCaller
 {
 private:
-    auto load_all_reads(std::size_t ref_size) 
-    {
-        std::ifstream ifs(in_path);
-        assert(ifs);
-
-        std::vector<std::vector<SAMRecord>> reads_map;
-        reads_map.resize(ref_size);
-
-        std::string line;
-        // read header
-        while (std::getline(ifs, line) && line[0] == '@');
-        do {
-            std::istringstream iss(line);
-            SAMRecord record;
-            iss >> record;
-            reads_map[record.get_alignment_begin()].emplace_back(std::move(record));
-        } while (std::getline(ifs, line));
-        return reads_map;
-    }
-
-    auto select_one_read(const std::vector<SAMRecord>& reads)
-    {
-        std::random_device rd;
-        std::mt19937 gen(rd());
-        std::uniform_int_distribution<> dis(0, reads.size()-1);
-        return reads[dis(gen)];
-    }
+    /** Reads shared between the overlapping regions they fall into. */
+    using SharedReads = std::vector<std::shared_ptr<const SAMRecord>>;
 
-    void filter_reads(std::vector<SAMRecord>& reads)
+    std::vector<ClippedRead> hard_clip_reads(const std::vector<ClippedRead>& reads, const Interval& padded_region, RegionReadFilters& filters)
     {
-        reads.erase(std::remove_if(reads.begin(), reads.end(),
-            MappingQualityReadFilter{}
-        ), reads.end());
-        reads.erase(std::remove_if(reads.begin(), reads.end(),
-            DuplicateReadFilter{}
-        ), reads.end());
-        reads.erase(std::remove_if(reads.begin(), reads.end(),
-            SecondaryAlignmentReadFilter{}
-        ), reads.end());
-        reads.erase(std::remove_if(reads.begin(), reads.end(),
-            MateOnSameContigReadFilter{}
-        ), reads.end());
+        std::vector<ClippedRead> clipped;
+        clipped.reserve(reads.size());
+        for (const auto& read : reads)
+            if (auto view = ReadClipper::hard_clip_to_interval(read, padded_region); !filters(view))
+                clipped.push_back(view);
+        return clipped;
     }
 
-    void hard_clip_reads(std::vector<SAMRecord>& reads, const Interval& padded_region)
-    {
-        std::for_each(reads.begin(), reads.end(),[](auto& read){
-            // if (read.has_well_defined_fragment_size())
-                ReadClipper::revert_soft_clipped_bases(read);
-            // else ReadClipper::hard_clip_soft_clipped_bases(read);
-        });
-        std::for_each(reads.begin(), reads.end(), [&](auto& read){
-            ReadClipper::hard_clip_to_interval(read, padded_region);
-        });
-        reads.erase(std::remove_if(reads.begin(), reads.end(),
-            MinimumLengthReadFilter{}
-        ), reads.end());
-    }
-
-    void call_region(std::vector<SAMRecord>& reads,
+    void call_region(const std::vector<ClippedRead>& reverted_reads,
                     std::string_view ref,
                     const Interval& padded_region,
                     const Interval& origin_region,
-                    std::ostream& os)
+                    TaskRuntime& runtime,
+                    RegionReadFilters& filters,
+                    std::ostream& os,
+                    std::ostream& log)
     {
-        Assembler assembler;
-        IntelPairHMM pairhmm;
-        Genetyper genetyper;
+        // scratch containers of all three stages come from the region's arena
+        RegionArena arena;
+        Assembler assembler(log, arena.resource(), concurrent_kmer_sizes ? &runtime : nullptr, adaptive_pruning);
+        IntelPairHMM pairhmm(&runtime, arena.resource());
+        Genetyper genetyper(arena.resource());
 
-        filter_reads(reads);
-        hard_clip_reads(reads, padded_region);
-        
+        auto reads = hard_clip_reads(reverted_reads, padded_region, filters);
         if (reads.empty()) return;
-        std::cout << "----------------------------------------------------------------------------------\n";
-        std::cout << "Assembling " << origin_region.to_string() << " with " << reads.size() << " reads:    (with overlap region = " << padded_region.to_string() << ")\n";
+        log << "----------------------------------------------------------------------------------\n";
+        log << "Assembling " << origin_region.to_string() << " with " << reads.size() << " reads:    (with overlap region = " << padded_region.to_string() << ")\n";
 
         auto haplotypes = assembler.assemble(reads, ref);
         if (haplotypes.size() <= 1) return;
@@ -106,26 +74,43 @@ private:
             variant.print(os);
     }
     
-public:
-    std::string in_path, out_path, ref_path;
-
-    void do_work(std::size_t region_size = 245,
-                 std::size_t padding_size = 85)
+    /** Variants, log lines and filter counts of one window, emitted in window order. */
+    struct RegionOutput
     {
-        std::ifstream ifs(ref_path);
-        assert(ifs);
+        std::string vcf, log;
+        RegionReadFilters filters;
+    };
 
-        auto fasta = Fasta{};
-        ifs >> fasta;
-        ifs.close();
+    RegionOutput run_region(const std::vector<ClippedRead>& reads,
+                            std::string_view ref,
+                            const Interval& padded_region,
+                            const Interval& origin_region,
+                            TaskRuntime& runtime)
+    {
+        std::ostringstream os, log;
+        RegionReadFilters filters;
+        call_region(reads, ref, padded_region, origin_region, runtime, filters, os, log);
+        return {os.str(), log.str(), filters};
+    }
 
-        std::transform(fasta.seq.begin(), fasta.seq.end(), fasta.seq.begin(), ::toupper);
-        auto ref = std::string_view{fasta.seq};
+public:
+    std::string in_path, out_path, ref_path;
+    std::vector<Interval> intervals;
+    std::size_t threads = std::thread::hardware_concurrency();
+    std::size_t max_reads_per_alignment_start = 1;
+    std::uint64_t seed = 0;
+    std::vector<std::string> read_filters, disabled_read_filters;
+    bool concurrent_kmer_sizes = false;
+    bool adaptive_pruning = false;
 
-        auto windows_number = (ref.size() + region_size - 1) / region_size;
-        auto origin_region = Interval{fasta.name, 0, region_size};
-        auto padded_region = origin_region;
-        padded_region.end += padding_size;
+    void do_work(std::size_t min_region_size = 50,
+                 std::size_t max_region_size = 300,
+                 std::size_t min_padding = 50,
+                 std::size_t max_padding = 100)
+    {
+        auto fasta = IndexedFasta{ref_path};
+        auto load_filters = make_load_read_filters(read_filters, disabled_read_filters);
+        auto region_filters = RegionReadFilters{};
 
         auto ofs = std::ofstream{out_path};
         assert(ofs);
@@ -134,22 +119,170 @@ public:
         ofs << "##FORMAT=<ID=GT,Number=1,Type=String,Description=\"Genotype\">\n";
         ofs << "#CHROM	POS	ID	REF	ALT	QUAL	FILTER	INFO	FORMAT	NA12878\n";
 
-        auto reads_map = load_all_reads(ref.size());
-        for (auto i = 0u; i < windows_number; i++)
+        // group targets per contig, in reference dictionary order
+        const auto& contigs = fasta.contigs();
+        std::vector<std::vector<Interval>> targets(contigs.size());
+        if (intervals.empty())
+            for (std::size_t i = 0; i < contigs.size(); i++)
+                targets[i].emplace_back(contigs[i].name, 0, contigs[i].length);
+        for (const auto& target : intervals)
+        {
+            if (fasta.contains(target.contig))
+                targets[fasta.id(target.contig)].push_back(target);
+            else
+                std::cout << "Ignore " << target.to_string() << ":    (contig not in reference)\n";
+        }
+
+        // regions are independent tasks; their outputs are emitted in submission
+        // order, which is genomic order, so the VCF does not depend on threads.
+        // A contig is released once its last region has been emitted.
+        struct PendingRegion
+        {
+            std::future<RegionOutput> output;
+            const std::string* release_contig = nullptr;
+        };
+        std::deque<PendingRegion> pending;
+        auto runtime = TaskRuntime{threads};
+        auto max_in_flight = std::max<std::size_t>(runtime.size(), 1) * 4;
+
+        auto emit_front = [&]{
+            auto& front = pending.front();
+            auto output = front.output.get();
+            ofs << output.vcf;
+            std::cout << output.log;
+            region_filters += output.filters;
+            if (front.release_contig) fasta.release(*front.release_contig);
+            pending.pop_front();
+        };
+        auto push_log = [&](std::string log){
+            std::promise<RegionOutput> output;
+            output.set_value({{}, std::move(log), {}});
+            pending.push_back({output.get_future()});
+        };
+
+        // reads arrive filtered; each is downsampled, profiled and reverted once
+        // at load and then shared by every region it overlaps. Region boundaries
+        // follow the activity profile
+        auto downsampler = PositionalDownsampler{max_reads_per_alignment_start, seed};
+        auto scan_size = 16 * max_region_size;
+        auto keep_before = max_padding + SAMRecord::MAX_READ_LENGTH;
+        auto lower = [](std::size_t pos, std::size_t distance){ return pos > distance ? pos - distance : 0; };
+
+        // one reader for the whole run, advanced through the contigs in dictionary order
+        std::vector<std::string> dictionary;
+        for (const auto& contig : contigs)
+            dictionary.push_back(contig.name);
+        auto read_buffer = ReadBuffer{in_path, dictionary, load_filters, &runtime};
+
+        for (std::size_t i = 0; i < contigs.size(); i++)
+        {
+            if (targets[i].empty()) continue;
+            const auto& contig = contigs[i].name;
+            auto ref = fasta.get(contig);
+            read_buffer.start(contig);
+            std::size_t regions = 0;
+
+            for (std::size_t t = 0; t < targets[i].size(); t++)
+            {
+                const auto& target = targets[i][t];
+                auto target_end = std::min(target.end, ref.size());
+                if (target.begin >= target_end) continue;
+
+                // a stream cannot go back, so the reads the next target starts with stay buffered
+                read_buffer.keep_from(t + 1 < targets[i].size() ? lower(targets[i][t+1].begin, keep_before)
+                                                                : std::numeric_limits<std::size_t>::max());
+
+                read_buffer.jump_to({contig, lower(target.begin, keep_before), target_end + max_padding});
+
+                // selected holds the reads as loaded, reverted the views of them with soft clips reverted
+                std::deque<std::shared_ptr<const SAMRecord>> selected;
+                std::deque<ClippedRead> reverted;
+                auto loaded = lower(target.begin, keep_before);
+                auto cursor = target.begin;
+                ActivityProfile profile(lower(cursor, max_padding));
+                while (cursor < target_end)
+                {
+                    auto chunk_end = std::min(cursor + scan_size, target_end);
+                    auto load_end = chunk_end + max_padding;
+                    profile.drop_before(lower(cursor, max_padding));
+                    read_buffer.for_each_start({contig, loaded, load_end}, [&](const auto& reads_at_begin){
+                        downsampler.sample(contig, reads_at_begin, [&](SAMRecord&& read){
+                            const auto& loaded_read = *selected.emplace_back(std::make_shared<const SAMRecord>(std::move(read)));
+                            profile.add(loaded_read, ref, 0);
+                            reverted.push_back(ReadClipper::revert_soft_clipped_bases(loaded_read));
+                        });
+                    });
+                    loaded = load_end;
+
+                    for (auto [begin, end, active] : profile.cut(cursor, chunk_end, chunk_end == target_end, min_region_size, max_region_size))
+                    {
+                        if (pending.size() >= max_in_flight) emit_front();
+                        regions++;
+                        cursor = end;
+
+                        auto origin_region = Interval{contig, begin, end};
+                        if (!active)
+                        {
+                            push_log("Skip " + origin_region.to_string() + ":    (no active position)\n");
+                            continue;
+                        }
+                        auto [left, right] = profile.padding(begin, end, min_padding, max_padding);
+                        auto padded_region = Interval{contig, begin - left, std::min(end + right, ref.size())};
+
+                        // a read overlapping the padded region may begin up to a read length before it
+                        auto by_begin = [](const auto& read, std::size_t pos){ return read->get_alignment_begin() < pos; };
+                        auto first = std::lower_bound(selected.begin(), selected.end(), lower(padded_region.begin, SAMRecord::MAX_READ_LENGTH), by_begin);
+                        auto last  = std::lower_bound(first, selected.end(), padded_region.end, by_begin);
+
+                        // owners keeps the records behind the views alive after they leave selected
+                        auto owners = SharedReads{};
+                        auto reads = std::vector<ClippedRead>{};
+                        for (auto it = first; it != last; ++it)
+                        {
+                            const auto& read = reverted[it - selected.begin()];
+                            if (read.get_alignment_end() <= padded_region.begin) continue;
+                            owners.push_back(*it);
+                            reads.push_back(read);
+                        }
+                        if (reads.empty())
+                        {
+                            push_log("Ignore " + origin_region.to_string() + ":    (with overlap region = " + padded_region.to_string() + ")\n");
+                            continue;
+                        }
+                        pending.push_back({runtime.submit([=, &runtime, owners = std::move(owners), reads = std::move(reads)]{
+                            return run_region(reads, ref.substr(padded_region.begin, padded_region.size()), padded_region, origin_region, runtime);
+                        })});
+                    }
+
+                    while (!selected.empty() && selected.front()->get_alignment_begin() + keep_before < cursor)
+                    {
+                        selected.pop_front();
+                        reverted.pop_front();
+                    }
+                }
+            }
+            if (regions == 0) fasta.release(contig);
+            else pending.back().release_contig = &contig;
+        }
+        while (!pending.empty())
+            emit_front();
+
+        if (runtime.size() > 0)
+        {
+            auto [idle, total] = runtime.idle_time();
+            std::cout << std::fixed << std::setprecision(2) << "Worker threads were idle " << idle << " s of " << total << " s ("
+                      << static_cast<int>(100 * idle / total) << "%).\n";
+        }
+
+        if (read_buffer.from_shard())
+            std::cout << "Read filters were applied when " << in_path << " was written.\n";
+        else
         {
-            std::vector<SAMRecord> reads;
-            for (auto begin = padded_region.begin; begin != padded_region.end; begin++)
-                if (!reads_map[begin].empty() && begin < reads_map.size())
-                    reads.emplace_back(select_one_read(reads_map[begin]));
-            
-            if (reads.empty()) std::cout << "Ignore " << origin_region.to_string() << ":    (with overlap region = " << padded_region.to_string() << ")\n";
-            else call_region(reads, ref.substr(padded_region.begin, padded_region.size()), padded_region, origin_region, ofs);
-
-            origin_region.begin += region_size;
-            origin_region.end   += region_size;
-            padded_region.begin  = origin_region.begin - padding_size;
-            padded_region.end    = origin_region.end   + padding_size;
+            std::cout << "Read filters applied at load:\n";
+            load_filters.report(std::cout);
         }
+        std::cout << "Read filters applied per region after clipping:\n";
+        region_filters.report(std::cout);
         std::cout << "HaplotypeCaller done." << '\n';
     }
 };
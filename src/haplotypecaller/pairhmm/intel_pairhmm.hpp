@@ -3,12 +3,15 @@
 #include <algorithm>
 #include <vector>
 #include <cmath>
+#include <mutex>
+#include <memory_resource>
 #include "../haplotype/haplotype.hpp"
-#include "../sam/sam.hpp"
+#include "../sam/clipped_read.hpp"
 #include "../utils/debug.h"
+#include "../utils/math_utils.hpp"
 #include "native/avx-pairhmm.h"
 #include "native/shacc_pairhmm.h"
-#include <omp.h>
+#include "../utils/task_runtime.hpp"
 
 namespace hc
 {
@@ -21,7 +24,7 @@ private:
     static constexpr double EXPECTED_ERROR_RATE_PER_BASE = 0.02;
     static constexpr double LOG10_QUALITY_PER_BASE = -4.0;
     static constexpr double MAXIMUM_EXPECTED_ERROR_PER_READ = 2.0;
-    void normalize_likelihoods_and_filter_poorly_modeled_reads(std::vector<SAMRecord>& reads, std::vector<std::vector<double>>& log_likelihoods)
+    void normalize_likelihoods_and_filter_poorly_modeled_reads(std::vector<ClippedRead>& reads, LikelihoodMatrix& log_likelihoods)
     {
         std::vector<std::size_t> remove_indices;
         for (std::size_t i = 0; i < log_likelihoods.size(); i++)
@@ -45,18 +48,42 @@ private:
         remove_by_sorted_indices(reads, remove_indices);
     }
 public:
+    /** Without a runtime, every (read, haplotype) pair is computed on the calling thread. */
+    IntelPairHMM(TaskRuntime* runtime = nullptr,
+                 std::pmr::memory_resource* resource = std::pmr::get_default_resource())
+        : runtime(runtime), resource(resource) {}
+
     auto compute_likelihoods(const std::vector<Haplotype>& haplotypeDataArray,
-                             std::vector<SAMRecord>& readDataArray)
+                             std::vector<ClippedRead>& readDataArray)
     {
         initNative();
-        std::vector<std::vector<double>> likelihoodArray(readDataArray.size(), std::vector<double>(haplotypeDataArray.size()));
+        LikelihoodMatrix likelihoodArray(readDataArray.size(), std::pmr::vector<double>(haplotypeDataArray.size(), resource), resource);
         computeLikelihoodsNative(readDataArray, haplotypeDataArray, likelihoodArray);
         normalize_likelihoods_and_filter_poorly_modeled_reads(readDataArray, likelihoodArray);
         return likelihoodArray;
     }
 private:
+    // (read, haplotype) pairs are split into tasks of at least this many DP cells;
+    // smaller windows are not worth spreading across workers
+    static constexpr std::size_t MIN_CELLS_PER_TASK = 1 << 20;
+
+    TaskRuntime* runtime;
+    std::pmr::memory_resource* resource;
     bool g_use_double;
-    int  g_max_threads;
+
+    // the native kernels share static tables; fill them once, before any Context is built
+    struct StaticTables
+    {
+        StaticTables()
+        {
+            static std::once_flag once;
+            std::call_once(once, []{
+                Context<float>{};
+                Context<double>{};
+                ConvertChar::init();
+            });
+        }
+    } static_tables;
 
     Context<float> g_ctxf;
     Context<double> g_ctxd;
@@ -64,39 +91,21 @@ private:
     float (*g_compute_full_prob_float)(testcase *tc);
     double (*g_compute_full_prob_double)(testcase *tc);
 
-    std::vector<std::vector<testcase>> m_testcases;
+    std::pmr::vector<std::pmr::vector<testcase>> m_testcases{resource};
 private:
-    std::vector<std::vector<testcase>> getData(const std::vector<SAMRecord>& readDataArray,
-                                               const std::vector<Haplotype>& haplotypeDataArray);
-    void initNative(bool use_double = false, int max_threads = 64);
-    void computeLikelihoodsNative(const std::vector<SAMRecord>& readDataArray,
+    std::pmr::vector<std::pmr::vector<testcase>>& getData(const std::vector<ClippedRead>& readDataArray,
+                                                          const std::vector<Haplotype>& haplotypeDataArray);
+    void initNative(bool use_double = false);
+    void computeLikelihoodsNative(const std::vector<ClippedRead>& readDataArray,
                                   const std::vector<Haplotype>& haplotypeDataArray,
-                                  std::vector<std::vector<double>>& likelihoodArray);
+                                  LikelihoodMatrix& likelihoodArray);
 };
 
-void IntelPairHMM::initNative(bool use_double, int max_threads)
+void IntelPairHMM::initNative(bool use_double)
 {
     DBG("Enter");
 
     g_use_double = use_double;
-#ifdef _OPENMP
-    int avail_threads = omp_get_max_threads();
-    int req_threads = max_threads;
-    g_max_threads = std::min(req_threads, avail_threads);
-
-    DBG("Available threads: %d", avail_threads);
-    DBG("Requested threads: %d", req_threads);
-    if (req_threads > avail_threads) {
-        DBG("Using %d available threads, but %d were requested", g_max_threads, req_threads);
-    }
-    else {
-        DBG("Using %d threads", g_max_threads);
-    }
-#else
-    if (max_threads != 1) {
-        DBG("Ignoring request for %d threads; not using OpenMP implementation", max_threads);
-    }
-#endif
 
     // enable FTZ
     if (_MM_GET_FLUSH_ZERO_MODE() != _MM_FLUSH_ZERO_ON) {
@@ -107,29 +116,34 @@ void IntelPairHMM::initNative(bool use_double, int max_threads)
     g_compute_full_prob_float = &compute_full_prob_avxs;
     g_compute_full_prob_double = &compute_full_prob_avxd;
 
-    // init convert char table
-    ConvertChar::init();
     DBG("Exit");
 }
 
-void IntelPairHMM::computeLikelihoodsNative(const std::vector<SAMRecord>& readDataArray,
+void IntelPairHMM::computeLikelihoodsNative(const std::vector<ClippedRead>& readDataArray,
                                             const std::vector<Haplotype>& haplotypeDataArray,
-                                            std::vector<std::vector<double>>& likelihoodArray)
+                                            LikelihoodMatrix& likelihoodArray)
 {
     DBG("Enter");
 
     //==================================================================
     // get data
-    auto testcases = getData(readDataArray, haplotypeDataArray);
+    auto& testcases = getData(readDataArray, haplotypeDataArray);
 
     //==================================================================
     // calcutate pairHMM
 
-#ifdef _OPENMP
-#pragma omp parallel for schedule(dynamic, 1) num_threads(g_max_threads)
-#endif
-    for (int i = 0; i < testcases.size(); i++) {
-        for (int j = 0; j < testcases[0].size(); j++) {
+    auto num_haplotypes = haplotypeDataArray.size();
+    auto num_pairs = testcases.size() * num_haplotypes;
+    std::size_t read_cells = 0, haplotype_cells = 0;
+    for (const auto& read : readDataArray) read_cells += read.size();
+    for (const auto& haplotype : haplotypeDataArray) haplotype_cells += haplotype.bases.size();
+    auto num_tasks = runtime == nullptr ? 1 : std::clamp<std::size_t>(read_cells * haplotype_cells / MIN_CELLS_PER_TASK, 1, num_pairs);
+
+    auto compute_pairs = [&](std::size_t task) {
+        // FTZ is per thread; tasks may land on any worker
+        _MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+        for (auto p = num_pairs * task / num_tasks; p < num_pairs * (task + 1) / num_tasks; p++) {
+            auto i = p / num_haplotypes, j = p % num_haplotypes;
             double result_final = 0;
 
             float result_float = g_use_double ? 0.0f : g_compute_full_prob_float(&testcases[i][j]);
@@ -144,15 +158,18 @@ void IntelPairHMM::computeLikelihoodsNative(const std::vector<SAMRecord>& readDa
             likelihoodArray[i][j] = result_final;
             DBG("result = %e", result_final);
         }
-    }
+    };
+
+    if (num_tasks == 1) compute_pairs(0);
+    else runtime->parallel_for(num_tasks, compute_pairs);
 
     //==================================================================
     // release data
     DBG("Exit");
 }
 
-std::vector<std::vector<testcase>>
-IntelPairHMM::getData(const std::vector<SAMRecord>& readDataArray,
+std::pmr::vector<std::pmr::vector<testcase>>&
+IntelPairHMM::getData(const std::vector<ClippedRead>& readDataArray,
                       const std::vector<Haplotype>& haplotypeDataArray)
 {
     int numReads = readDataArray.size();
@@ -173,17 +190,19 @@ IntelPairHMM::getData(const std::vector<SAMRecord>& readDataArray,
     }
 
     // get reads and create testcases
+    m_testcases.reserve(m_testcases.size() + numReads);
     for (int r = 0; r < numReads; r++) {
-        int length = readDataArray[r].SEQ.length();
-        const char* reads = readDataArray[r].SEQ.data();
+        int length = readDataArray[r].size();
+        const char* reads = readDataArray[r].seq().data();
         int readLength = length;
         const char* insGops = readDataArray[r].insertionGOP().data();
         const char* delGops = readDataArray[r].deletionGOP().data();
         const char* gapConts = readDataArray[r].overallGCP().data();
-        const char* readQuals = readDataArray[r].QUAL.data();
+        const char* readQuals = readDataArray[r].qual().data();
         total_read_length += length;
 
-        std::vector<testcase> n_testcases;
+        std::pmr::vector<testcase> n_testcases(resource);
+        n_testcases.reserve(numHaplotypes);
         for (int h = 0; h < numHaplotypes; h++) {
             testcase tc;
             tc.hap = haplotypes[h];
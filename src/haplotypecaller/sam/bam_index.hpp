@@ -0,0 +1,206 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "bgzf.hpp"
+
+namespace hc
+{
+
+/**
+ * BAI or CSI index of a coordinate-sorted BAM file.
+ *
+ * Both formats share the hierarchical binning scheme; BAI fixes it at
+ * min_shift = 14 and depth = 5 and adds a linear index of 16kb windows,
+ * while CSI stores the minimum offset per bin instead.
+ */
+class BAMIndex
+{
+public:
+    struct Chunk
+    {
+        std::uint64_t begin;
+        std::uint64_t end;
+    };
+
+private:
+    static constexpr std::uint32_t BAI_PSEUDO_BIN = 37450;
+    static constexpr int BAI_MIN_SHIFT = 14;
+    static constexpr int BAI_DEPTH = 5;
+
+    struct Bin
+    {
+        std::uint64_t min_offset = 0;
+        std::vector<Chunk> chunks;
+    };
+
+    struct Reference
+    {
+        std::unordered_map<std::uint32_t, Bin> bins;
+        std::vector<std::uint64_t> linear_index;
+    };
+
+    int min_shift = BAI_MIN_SHIFT;
+    int depth = BAI_DEPTH;
+    bool is_csi = false;
+    std::vector<Reference> references;
+
+    template <typename T, typename Source>
+    static T read_value(Source& source)
+    {
+        T value;
+        source.read_exactly(&value, sizeof(T));
+        return value;
+    }
+
+    struct StreamSource
+    {
+        std::ifstream& ifs;
+        void read_exactly(void* dst, std::size_t n)
+        {
+            if (!ifs.read(static_cast<char*>(dst), n))
+                throw std::runtime_error("BAMIndex: truncated index");
+        }
+    };
+
+    template <typename Source>
+    void load(Source& source)
+    {
+        if (is_csi)
+        {
+            min_shift = read_value<std::int32_t>(source);
+            depth = read_value<std::int32_t>(source);
+            std::string aux(read_value<std::int32_t>(source), '\0');
+            source.read_exactly(aux.data(), aux.size());
+        }
+
+        references.resize(read_value<std::int32_t>(source));
+        for (auto& reference : references)
+        {
+            auto n_bin = read_value<std::int32_t>(source);
+            for (std::int32_t i = 0; i < n_bin; i++)
+            {
+                auto bin_id = read_value<std::uint32_t>(source);
+                Bin bin;
+                if (is_csi) bin.min_offset = read_value<std::uint64_t>(source);
+                bin.chunks.resize(read_value<std::int32_t>(source));
+                source.read_exactly(bin.chunks.data(), bin.chunks.size() * sizeof(Chunk));
+                if (bin_id != BAI_PSEUDO_BIN)
+                    reference.bins.emplace(bin_id, std::move(bin));
+            }
+            if (!is_csi)
+            {
+                reference.linear_index.resize(read_value<std::int32_t>(source));
+                source.read_exactly(reference.linear_index.data(), reference.linear_index.size() * sizeof(std::uint64_t));
+            }
+        }
+    }
+
+    /** All bins that may hold reads overlapping [begin, end). */
+    std::vector<std::uint32_t> region_to_bins(std::uint64_t begin, std::uint64_t end) const
+    {
+        std::vector<std::uint32_t> bins;
+        end--;
+        std::uint32_t first_bin_on_level = 0;
+        for (int level = 0, shift = min_shift + depth * 3; level <= depth; level++, shift -= 3)
+        {
+            for (auto bin = first_bin_on_level + (begin >> shift); bin <= first_bin_on_level + (end >> shift); bin++)
+                bins.push_back(bin);
+            first_bin_on_level += 1u << (level * 3);
+        }
+        return bins;
+    }
+
+    /** Smallest virtual offset a read overlapping begin can have. */
+    std::uint64_t min_offset(const Reference& reference, std::uint64_t begin) const
+    {
+        if (!is_csi)
+        {
+            auto window = begin >> BAI_MIN_SHIFT;
+            if (reference.linear_index.empty()) return 0;
+            return reference.linear_index[std::min<std::size_t>(window, reference.linear_index.size() - 1)];
+        }
+
+        // walk from the finest bin covering begin towards the root
+        for (int level = depth, shift = min_shift; level >= 0; level--, shift += 3)
+        {
+            auto first_bin_on_level = ((1u << (level * 3)) - 1) / 7;
+            auto bin = first_bin_on_level + static_cast<std::uint32_t>(begin >> shift);
+            if (auto it = reference.bins.find(bin); it != reference.bins.end())
+                return it->second.min_offset;
+        }
+        return 0;
+    }
+
+public:
+    /** Finds the index of a BAM file: path.bai, path.csi or path with .bam replaced by .bai. */
+    static std::string locate(const std::string& bam_path)
+    {
+        std::vector<std::string> candidates{bam_path + ".bai", bam_path + ".csi"};
+        if (auto dot = bam_path.rfind('.'); dot != std::string::npos)
+            candidates.push_back(bam_path.substr(0, dot) + ".bai");
+        for (const auto& candidate : candidates)
+            if (std::ifstream(candidate)) return candidate;
+        return {};
+    }
+
+    BAMIndex(const std::string& path)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs)
+            throw std::runtime_error("BAMIndex: cannot open " + path);
+
+        char magic[4]{};
+        ifs.read(magic, 4);
+        if (std::memcmp(magic, "BAI\1", 4) == 0)
+        {
+            StreamSource source{ifs};
+            load(source);
+            return;
+        }
+
+        ifs.close();
+        BGZFReader bgzf(path, 0);
+        bgzf.read_exactly(magic, 4);
+        if (std::memcmp(magic, "CSI\1", 4) != 0)
+            throw std::runtime_error("BAMIndex: " + path + " is neither BAI nor CSI");
+        is_csi = true;
+        load(bgzf);
+    }
+
+    /** Sorted, merged chunks that contain every read overlapping [begin, end) of reference ref_id. */
+    std::vector<Chunk> query(std::size_t ref_id, std::uint64_t begin, std::uint64_t end) const
+    {
+        end = std::min(end, std::uint64_t{1} << (min_shift + depth * 3));
+        if (ref_id >= references.size() || begin >= end) return {};
+        const auto& reference = references[ref_id];
+        auto min = min_offset(reference, begin);
+
+        std::vector<Chunk> chunks;
+        for (auto bin : region_to_bins(begin, end))
+            if (auto it = reference.bins.find(bin); it != reference.bins.end())
+                for (auto chunk : it->second.chunks)
+                    if (chunk.end > min)
+                        chunks.push_back(chunk);
+
+        std::sort(chunks.begin(), chunks.end(),
+            [](const auto& lhs, const auto& rhs){ return lhs.begin < rhs.begin; });
+        std::vector<Chunk> merged;
+        for (auto chunk : chunks)
+        {
+            if (!merged.empty() && chunk.begin <= merged.back().end)
+                merged.back().end = std::max(merged.back().end, chunk.end);
+            else
+                merged.push_back(chunk);
+        }
+        return merged;
+    }
+};
+
+} // hc
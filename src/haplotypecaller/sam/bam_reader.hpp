@@ -0,0 +1,213 @@
+#pragma once
+
+#include <memory>
+#include <fstream>
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include "sam.hpp"
+#include "bgzf.hpp"
+#include "bam_index.hpp"
+#include "bam_record_view.hpp"
+#include "packed_bases.hpp"
+#include "read_source.hpp"
+
+namespace hc
+{
+
+/**
+ * Reads binary BAM records in place as BAMRecordView, which ReadBuffer packs
+ * into CompactRead as they are; next(SAMRecord&) materialises the view.
+ */
+struct BAMReader : ReadSource
+{
+private:
+    static constexpr char BAM_MAGIC[4] = {'B', 'A', 'M', '\1'};
+    static constexpr std::size_t FIXED_FIELDS_LENGTH = 32;
+
+    BGZFReader bgzf;
+    std::unique_ptr<BAMIndex> index;
+    std::vector<std::string> contig_names;
+    std::vector<std::size_t> contig_lengths;
+    std::vector<char> buffer;  // the record the last view points into
+    BAMRecordView view;        // next(SAMRecord&) decodes here first
+
+    // active region query, see query()
+    bool in_region = false;
+    std::size_t region_begin = 0, region_end = 0;
+    std::string region_contig;
+    std::vector<BAMIndex::Chunk> chunks;
+    std::size_t chunk_index = 0;
+
+    template <typename T>
+    T read_value()
+    {
+        T value;
+        bgzf.read_exactly(&value, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    static T get(const char* data)
+    {
+        T value;
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    void read_header()
+    {
+        char magic[4];
+        bgzf.read_exactly(magic, 4);
+        if (std::memcmp(magic, BAM_MAGIC, 4) != 0)
+            throw std::runtime_error("BAMReader: invalid BAM magic");
+
+        std::string text(read_value<std::int32_t>(), '\0');
+        bgzf.read_exactly(text.data(), text.size());
+
+        auto n_ref = read_value<std::int32_t>();
+        for (std::int32_t i = 0; i < n_ref; i++)
+        {
+            std::string name(read_value<std::int32_t>(), '\0');
+            bgzf.read_exactly(name.data(), name.size());
+            name.pop_back();
+            contig_names.push_back(std::move(name));
+            contig_lengths.push_back(read_value<std::int32_t>());
+        }
+    }
+
+    std::string_view contig_name(std::int32_t id) const
+    {
+        if (id < 0) return "*";
+        return contig_names.at(id);
+    }
+
+    /** Decodes the block_size bytes at data; throws if the variable-length fields overrun them. */
+    void decode(const char* data, std::size_t block_size, BAMRecordView& record)
+    {
+        auto ref_id        = get<std::int32_t> (data);
+        auto pos           = get<std::int32_t> (data + 4);
+        auto l_read_name   = get<std::uint8_t> (data + 8);
+        auto mapq          = get<std::uint8_t> (data + 9);
+        auto n_cigar_op    = get<std::uint16_t>(data + 12);
+        auto flag          = get<std::uint16_t>(data + 14);
+        auto l_seq         = get<std::int32_t> (data + 16);
+        auto next_ref_id   = get<std::int32_t> (data + 20);
+        auto next_pos      = get<std::int32_t> (data + 24);
+        auto tlen          = get<std::int32_t> (data + 28);
+
+        if (l_read_name < 1 || l_seq < 0 ||
+            FIXED_FIELDS_LENGTH + l_read_name + n_cigar_op * 4 + PackedBases::packed_size(l_seq) + std::size_t(l_seq) > block_size)
+            throw std::runtime_error("BAMReader: corrupt record");
+
+        auto p = data + FIXED_FIELDS_LENGTH;
+        record.QNAME = std::string_view(p, l_read_name - 1);
+        p += l_read_name;
+        record.cigar   = p;
+        record.n_cigar = n_cigar_op;
+        p += n_cigar_op * 4;
+        record.seq   = reinterpret_cast<const std::uint8_t*>(p);
+        record.l_seq = l_seq;
+        p += PackedBases::packed_size(l_seq);
+        record.qual  = p;
+
+        record.FLAG  = flag;
+        record.RNAME = contig_name(ref_id);
+        record.POS   = pos + 1;
+        record.MAPQ  = mapq;
+        record.RNEXT = next_ref_id >= 0 && next_ref_id == ref_id ? std::string_view("=") : contig_name(next_ref_id);
+        record.PNEXT = next_pos + 1;
+        record.TLEN  = tlen;
+    }
+
+    bool read_record(BAMRecordView& record)
+    {
+        std::int32_t block_size;
+        auto n = bgzf.read(&block_size, sizeof(block_size));
+        if (n == 0) return false;
+        if (n != sizeof(block_size) || block_size < static_cast<std::int32_t>(FIXED_FIELDS_LENGTH))
+            throw std::runtime_error("BAMReader: truncated record");
+
+        buffer.resize(block_size);
+        bgzf.read_exactly(buffer.data(), block_size);
+        decode(buffer.data(), block_size, record);
+        return true;
+    }
+
+    void next_chunk()
+    {
+        if (++chunk_index < chunks.size())
+            bgzf.seek(chunks[chunk_index].begin, chunks[chunk_index].end);
+    }
+
+public:
+    /** Blocks are inflated on runtime, see BGZFReader. */
+    BAMReader(const std::string& path, TaskRuntime* runtime = nullptr)
+        : BAMReader(BGZFReader::open(path), path, runtime) {}
+
+    /** Reads from ifs, already opened on path; the index is looked up next to path. */
+    BAMReader(std::ifstream ifs, const std::string& path, TaskRuntime* runtime = nullptr)
+        : bgzf(std::move(ifs), runtime)
+    {
+        read_header();
+        if (auto index_path = BAMIndex::locate(path); !index_path.empty())
+            index = std::make_unique<BAMIndex>(index_path);
+    }
+
+    bool next(SAMRecord& record) override
+    {
+        if (!next(view)) return false;
+        view.materialize(record);
+        return true;
+    }
+
+    View views() const override { return View::BAM; }
+
+    /** The view points into a buffer the next call to next() or query() overwrites. */
+    bool next(BAMRecordView& record) override
+    {
+        if (!in_region) return read_record(record);
+
+        while (chunk_index < chunks.size())
+        {
+            if (bgzf.tell() >= chunks[chunk_index].end)
+            {
+                next_chunk();
+                continue;
+            }
+            if (!read_record(record)) break;
+            if (record.RNAME != region_contig || record.get_alignment_begin() >= region_end) break;
+            if (record.get_alignment_begin() >= region_begin) return true;
+        }
+        chunk_index = chunks.size();
+        return false;
+    }
+
+    /** Seeks through the BAI/CSI index; only blocks holding the region are read. */
+    bool query(const std::string& contig, std::size_t begin, std::size_t end) override
+    {
+        if (!index) return false;
+        auto it = std::find(contig_names.begin(), contig_names.end(), contig);
+        chunks.clear();
+        if (it != contig_names.end())
+            chunks = index->query(it - contig_names.begin(), begin, end);
+        chunk_index = 0;
+        if (!chunks.empty())
+            bgzf.seek(chunks[0].begin, chunks[0].end);
+
+        in_region = true;
+        region_contig = contig;
+        region_begin = begin;
+        region_end = end;
+        return true;
+    }
+
+    const auto& get_contig_names() const { return contig_names; }
+    const auto& get_contig_lengths() const { return contig_lengths; }
+};
+
+} // hc
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string_view>
+#include <cstring>
+#include <cstdint>
+#include "sam.hpp"
+#include "cigar.hpp"
+#include "packed_bases.hpp"
+#include "../utils/quality_utils.hpp"
+
+namespace hc
+{
+
+/**
+ * One binary BAM record read in place: QNAME and the contig names are
+ * string_views, the CIGAR, the 4-bit SEQ and QUAL point into the record as
+ * BAM stores them. Fields are named as in SAMRecordView so the same read
+ * filters apply; materialize() produces an owning SAMRecord.
+ */
+struct BAMRecordView
+{
+    static constexpr std::uint8_t MISSING_QUALITY = 0xff;
+    // by BAM operator code; codes past X are invalid and left for CompactRead::pack to reject
+    static constexpr char OPERATORS[] = "MIDNSHP=X???????";
+
+    std::string_view    QNAME;
+    std::uint16_t       FLAG = 0;
+    std::string_view    RNAME;
+    std::uint32_t       POS = 0;
+    std::uint16_t       MAPQ = 0;
+    std::string_view    RNEXT;
+    std::uint32_t       PNEXT = 0;
+    std::int32_t        TLEN = 0;
+    const char*         cigar = nullptr;  // n_cigar packed operations, unaligned
+    std::uint16_t       n_cigar = 0;
+    const std::uint8_t* seq = nullptr;    // l_seq bases, two per byte
+    std::uint32_t       l_seq = 0;
+    const char*         qual = nullptr;   // l_seq phred scores without offset
+
+    bool READ_UNMAPPED()                   const { return (FLAG & 0x4  ) != 0; }
+    bool SECONDARY_ALIGNMENT()             const { return (FLAG & 0x100) != 0; }
+    bool READ_FAILS_VENDOR_QUALITY_CHECK() const { return (FLAG & 0x200) != 0; }
+    bool DUPLICATE_READ()                  const { return (FLAG & 0x400) != 0; }
+    bool SUPPLEMENTARY_ALIGNMENT()         const { return (FLAG & 0x800) != 0; }
+    auto get_alignment_begin() const { return POS - 1; }
+
+    std::uint32_t cigar_op(std::size_t i) const
+    {
+        std::uint32_t op;
+        std::memcpy(&op, cigar + i * sizeof(op), sizeof(op));
+        return op;
+    }
+
+    /** Bases the CIGAR takes from SEQ: the lengths of its M, I, S, = and X operations. */
+    std::size_t get_cigar_read_length() const
+    {
+        // by BAM operator code, see OPERATORS
+        static constexpr bool CONSUMES_READ[16] = {true, true, false, false, true, false, false, true, true};
+        std::size_t read_length = 0;
+        for (std::size_t i = 0; i < n_cigar; i++)
+            if (CONSUMES_READ[cigar_op(i) & 0xf]) read_length += cigar_op(i) >> 4;
+        return read_length;
+    }
+
+    bool has_quality() const
+    { return l_seq > 0 && static_cast<std::uint8_t>(qual[0]) != MISSING_QUALITY; }
+
+    void materialize(SAMRecord& record) const
+    {
+        record.QNAME.assign(QNAME);
+        record.FLAG = FLAG;
+        record.RNAME.assign(RNAME);
+        record.POS  = POS;
+        record.MAPQ = MAPQ;
+        record.CIGAR = Cigar{};
+        for (std::size_t i = 0; i < n_cigar; i++)
+            record.CIGAR.emplace_back(cigar_op(i) >> 4, CigarOperator(OPERATORS[cigar_op(i) & 0xf]));
+        record.RNEXT.assign(RNEXT);
+        record.PNEXT = PNEXT;
+        record.TLEN  = TLEN;
+        record.SEQ.resize(l_seq);
+        PackedBases::decode(seq, l_seq, record.SEQ.data());
+        if (!has_quality())
+            record.QUAL = "*";
+        else
+        {
+            record.QUAL.resize(l_seq);
+            for (std::size_t i = 0; i < l_seq; i++)
+                record.QUAL[i] = qual[i] + QualityUtils::ASCII_OFFSET;
+        }
+    }
+};
+
+} // hc
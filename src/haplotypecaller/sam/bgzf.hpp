@@ -0,0 +1,256 @@
+#pragma once
+
+#include <fstream>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <atomic>
+#include <future>
+#include <zlib.h>
+#include "../utils/task_runtime.hpp"
+
+namespace hc
+{
+
+/**
+ * Reader of BGZF-compressed files (BAM, CSI).
+ *
+ * Compressed blocks are read ahead on the calling thread and inflated as
+ * priority tasks of the TaskRuntime shared with the caller, so decompression
+ * of the next blocks overlaps with the caller consuming the current one
+ * without threads of its own; a block no worker has picked up by the time
+ * it is needed is inflated by the caller. Blocks are always handed out in
+ * file order.
+ * Positions are BGZF virtual offsets: the compressed block address in the
+ * upper 48 bits and the offset inside the inflated block in the lower 16
+ * bits.
+ */
+class BGZFReader
+{
+    static constexpr std::size_t BLOCK_HEADER_LENGTH = 18;
+    static constexpr std::size_t BLOCK_FOOTER_LENGTH = 8;
+    static constexpr std::size_t BLOCKS_IN_FLIGHT_PER_THREAD = 4;
+
+    struct Block
+    {
+        std::uint64_t address = 0;
+        std::vector<char> compressed;
+        std::vector<char> data;
+        std::string error;
+        std::future<void> inflated;
+        std::atomic<bool> dropped{false};
+        bool ready = false;
+    };
+
+    std::ifstream ifs;
+    std::uint64_t next_address = 0;
+    std::uint64_t limit_address = std::numeric_limits<std::uint64_t>::max();
+    bool eof = false;
+
+    // a block is shared with its inflate task, which may still be queued once the block is dropped
+    std::deque<std::shared_ptr<Block>> blocks;
+    std::size_t offset = 0;
+    TaskRuntime* runtime;
+    std::size_t max_in_flight;
+
+    static void inflate_block(Block& block)
+    {
+        const auto& compressed = block.compressed;
+        std::uint32_t isize;
+        std::memcpy(&isize, compressed.data() + compressed.size() - 4, 4);
+        block.data.resize(isize);
+        if (isize == 0) return;
+
+        z_stream zs{};
+        zs.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+        zs.avail_in  = compressed.size() - BLOCK_FOOTER_LENGTH;
+        zs.next_out  = reinterpret_cast<Bytef*>(block.data.data());
+        zs.avail_out = isize;
+        if (inflateInit2(&zs, -15) != Z_OK)
+            block.error = "BGZFReader: inflateInit2 failed";
+        else
+        {
+            if (inflate(&zs, Z_FINISH) != Z_STREAM_END || zs.total_out != isize)
+                block.error = "BGZFReader: corrupted block";
+            inflateEnd(&zs);
+        }
+    }
+
+    bool read_block()
+    {
+        auto block = std::make_shared<Block>();
+        block->address = next_address;
+
+        char header[BLOCK_HEADER_LENGTH];
+        ifs.read(header, BLOCK_HEADER_LENGTH);
+        if (ifs.gcount() == 0) return false;
+        if (static_cast<std::size_t>(ifs.gcount()) != BLOCK_HEADER_LENGTH ||
+            header[0] != '\x1f' || header[1] != '\x8b' || header[12] != 'B' || header[13] != 'C')
+            throw std::runtime_error("BGZFReader: invalid block header");
+
+        std::uint16_t bsize;
+        std::memcpy(&bsize, header + 16, 2);
+        block->compressed.resize(bsize + 1 - BLOCK_HEADER_LENGTH);
+        ifs.read(block->compressed.data(), block->compressed.size());
+        if (static_cast<std::size_t>(ifs.gcount()) != block->compressed.size())
+            throw std::runtime_error("BGZFReader: truncated block");
+        next_address += bsize + 1;
+
+        if (runtime == nullptr)
+        {
+            inflate_block(*block);
+            block->ready = true;
+        }
+        else block->inflated = runtime->submit_priority([block]{ if (!block->dropped) inflate_block(*block); });
+        blocks.push_back(std::move(block));
+        return true;
+    }
+
+    void fill()
+    {
+        while (!eof && blocks.size() < max_in_flight)
+            if (next_address > limit_address || !read_block())
+                eof = true;
+    }
+
+    void wait(Block* block)
+    {
+        if (block->ready) return;
+        runtime->wait(block->inflated);
+        block->inflated.get();
+        block->ready = true;
+    }
+
+    /** Returns the block being consumed, or nullptr at end of file. */
+    Block* current()
+    {
+        while (true)
+        {
+            fill();
+            if (blocks.empty()) return nullptr;
+
+            auto block = blocks.front().get();
+            wait(block);
+            if (!block->error.empty())
+                throw std::runtime_error(block->error);
+            if (offset < block->data.size()) return block;
+
+            blocks.pop_front();
+            offset = 0;
+        }
+    }
+
+    /**
+     * A task of a dropped block that has not started yet skips the inflation.
+     * The future goes too: its shared state holds the task, which holds the
+     * block, so a dropped block that kept it would never be freed.
+     */
+    static void drop(Block& block)
+    {
+        block.dropped = true;
+        block.inflated = {};
+    }
+
+    void drop_blocks()
+    {
+        for (auto& block : blocks)
+            drop(*block);
+        blocks.clear();
+    }
+
+public:
+    /** Opens path for reading, throws if it cannot be opened. */
+    static std::ifstream open(const std::string& path)
+    {
+        std::ifstream ifs(path, std::ios::binary);
+        if (!ifs)
+            throw std::runtime_error("BGZFReader: cannot open " + path);
+        return ifs;
+    }
+
+    /** Blocks are inflated on runtime, or on the calling thread without one. */
+    BGZFReader(const std::string& path, TaskRuntime* runtime = nullptr)
+        : BGZFReader(open(path), runtime) {}
+
+    /** Reads from a stream already opened, e.g. a pipe that cannot be opened twice. */
+    BGZFReader(std::ifstream ifs, TaskRuntime* runtime = nullptr)
+        : ifs(std::move(ifs)), runtime(runtime),
+          max_in_flight(std::max<std::size_t>(runtime ? runtime->size() : 0, 1) * BLOCKS_IN_FLIGHT_PER_THREAD) {}
+
+    BGZFReader(const BGZFReader&) = delete;
+    BGZFReader& operator=(const BGZFReader&) = delete;
+
+    ~BGZFReader() { drop_blocks(); }
+
+    /** Reads up to n bytes into dst, returns the number of bytes read. */
+    std::size_t read(void* dst, std::size_t n)
+    {
+        auto out = static_cast<char*>(dst);
+        std::size_t copied = 0;
+        while (copied < n)
+        {
+            auto block = current();
+            if (block == nullptr) break;
+            auto length = std::min(n - copied, block->data.size() - offset);
+            std::memcpy(out + copied, block->data.data() + offset, length);
+            offset += length;
+            copied += length;
+        }
+        return copied;
+    }
+
+    /** Virtual offset of the next byte to be read. */
+    std::uint64_t tell()
+    {
+        if (auto block = current(); block != nullptr)
+            return block->address << 16 | offset;
+        return next_address << 16;
+    }
+
+    /**
+     * Moves to virtual offset begin. If limit is given, read-ahead stops at
+     * the block containing virtual offset limit, so no block past it is
+     * fetched from disk.
+     */
+    void seek(std::uint64_t begin,
+              std::uint64_t limit = std::numeric_limits<std::uint64_t>::max())
+    {
+        auto address = begin >> 16;
+        limit_address = limit >> 16;
+
+        auto buffered = std::find_if(blocks.begin(), blocks.end(),
+            [address](const auto& block){ return block->address == address; });
+        if (buffered == blocks.end())
+        {
+            drop_blocks();
+            ifs.clear();
+            ifs.seekg(address);
+            next_address = address;
+        }
+        else
+        {
+            auto target = buffered->get();
+            while (blocks.front().get() != target)
+            {
+                drop(*blocks.front());
+                blocks.pop_front();
+            }
+        }
+        eof = false;
+        offset = begin & 0xffff;
+    }
+
+    void read_exactly(void* dst, std::size_t n)
+    {
+        if (read(dst, n) != n)
+            throw std::runtime_error("BGZFReader: unexpected end of file");
+    }
+};
+
+} // hc
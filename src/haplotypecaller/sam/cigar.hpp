@@ -1,7 +1,11 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
 #include <boost/serialization/vector.hpp>
 #include <ostream>
 #include <istream>
@@ -54,44 +58,66 @@ struct CigarElement
 struct Cigar
 {
 private:
-    static auto to_cigar_elements(const std::string& cigar_string)
+    static auto to_cigar_elements(std::string_view cigar_string)
     {
         std::vector<CigarElement> cigar_elements;
         for (std::size_t i = 0; i < cigar_string.size(); i++)
         {
             auto length = static_cast<std::uint32_t>(cigar_string[i] - '0');
-            for (i++; std::isdigit(cigar_string[i]); i++)
+            for (i++; i < cigar_string.size() && std::isdigit(cigar_string[i]); i++)
                 length = length * 10 + cigar_string[i] - '0';
             cigar_elements.emplace_back(length, CigarOperator(cigar_string[i]));
         }
         return cigar_elements;
     }
 
+    static auto to_cigar_elements(const std::uint32_t* packed, std::size_t size)
+    {
+        static constexpr char BAM_CIGAR_OPERATORS[] = "MIDNSHP=X";
+        std::vector<CigarElement> cigar_elements;
+        cigar_elements.reserve(size);
+        for (std::size_t i = 0; i < size; i++)
+            cigar_elements.emplace_back(packed[i] >> 4, CigarOperator(BAM_CIGAR_OPERATORS[packed[i] & 0xf]));
+        return cigar_elements;
+    }
+
 public:
     Cigar() = default;
     Cigar(const Cigar&) = default;
     Cigar(Cigar&&) = default;
     Cigar& operator=(const Cigar&) = default;
     Cigar& operator=(Cigar&&) = default;
-    Cigar(const std::string& cigar_string)
+    Cigar(std::string_view cigar_string)
         : cigar_elements(to_cigar_elements(cigar_string)) {}
+    /** From BAM's packed form: length << 4 | operator code. */
+    Cigar(const std::uint32_t* packed, std::size_t size)
+        : cigar_elements(to_cigar_elements(packed, size)) {}
     Cigar(size_t size, CigarElement element)
         : cigar_elements(size, element) {}
-    Cigar& operator=(const std::string& cigar_string)
+    Cigar& operator=(std::string_view cigar_string)
     {
+        reference_length = UNKNOWN_LENGTH;
         cigar_elements = to_cigar_elements(cigar_string);
         return *this;
     }
 
     void push_back(CigarElement element)
-    { cigar_elements.push_back(element); }
+    {
+        reference_length = UNKNOWN_LENGTH;
+        cigar_elements.push_back(element);
+    }
 
     void emplace_back(std::size_t length, CigarOperator op)
-    { cigar_elements.emplace_back(length, op); }
+    {
+        reference_length = UNKNOWN_LENGTH;
+        cigar_elements.emplace_back(length, op);
+    }
 
-    auto get_reference_length() const
+    /** Cached; every non-const access to the elements invalidates the cache. */
+    std::size_t get_reference_length() const
     {
-        std::size_t reference_length = 0;
+        if (reference_length != UNKNOWN_LENGTH) return reference_length;
+        reference_length = 0;
         for (auto [length, op] : cigar_elements)
         {
             switch (op)
@@ -140,25 +166,37 @@ public:
     }
 
     auto begin()
-    { return cigar_elements.begin(); }
+    {
+        reference_length = UNKNOWN_LENGTH;
+        return cigar_elements.begin();
+    }
 
     auto begin() const
     { return cigar_elements.begin(); }
 
     auto end()
-    { return cigar_elements.end(); }
+    {
+        reference_length = UNKNOWN_LENGTH;
+        return cigar_elements.end();
+    }
 
     auto end() const
     { return cigar_elements.end(); }
 
     auto& front()
-    { return cigar_elements.front(); }
+    {
+        reference_length = UNKNOWN_LENGTH;
+        return cigar_elements.front();
+    }
 
     auto& front() const
     { return cigar_elements.front(); }
 
     auto& back()
-    { return cigar_elements.back(); }
+    {
+        reference_length = UNKNOWN_LENGTH;
+        return cigar_elements.back();
+    }
 
     auto& back() const
     { return cigar_elements.back(); }
@@ -166,6 +204,9 @@ public:
     void reverse()
     { std::reverse(cigar_elements.begin(), cigar_elements.end()); }
 
+    std::size_t size() const
+    { return cigar_elements.size(); }
+
     bool contains(CigarOperator key) const
     {
         for (auto [size, op] : cigar_elements)
@@ -176,11 +217,16 @@ public:
 
     template <typename Archive>
     void serialize(Archive& ar, const unsigned int version)
-    { ar & cigar_elements; }
+    {
+        reference_length = UNKNOWN_LENGTH;
+        ar & cigar_elements;
+    }
 
     friend auto& operator<<(std::ostream& os, const Cigar& cigar);
 private:
+    static constexpr std::size_t UNKNOWN_LENGTH = std::numeric_limits<std::size_t>::max();
     std::vector<CigarElement> cigar_elements;
+    mutable std::size_t reference_length = UNKNOWN_LENGTH;
 };
 
 auto& operator<<(std::ostream& os, const Cigar& cigar)
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <string_view>
+#include "sam.hpp"
+#include "../utils/interval.hpp"
+
+namespace hc
+{
+
+/**
+ * A read as seen through ReadClipper, without copying it: [begin, end) of
+ * the record's SEQ and QUAL, and its alignment once reverted soft clips are
+ * counted as aligned bases. The record must outlive the view. cigar()
+ * rebuilds the CIGAR with the reverted ends only when asked.
+ */
+struct ClippedRead
+{
+    const SAMRecord* record = nullptr;
+    std::size_t begin = 0, end = 0;
+    std::size_t alignment_begin = 0, alignment_end = 0;
+    bool front_reverted = false, back_reverted = false;
+
+    ClippedRead() = default;
+    ClippedRead(const SAMRecord& record)
+        : record(&record), end(record.size()),
+          alignment_begin(record.get_alignment_begin()), alignment_end(record.get_alignment_end()) {}
+
+    std::string_view seq()  const { return std::string_view(record->SEQ). substr(begin, end - begin); }
+    std::string_view qual() const { return std::string_view(record->QUAL).substr(begin, end - begin); }
+
+    bool empty() const { return begin == end; }
+    auto size()  const { return end - begin; }
+
+    auto insertionGOP() const { return std::string_view{SAMRecord::GOP}.substr(0, size()); }
+    auto deletionGOP()  const { return std::string_view{SAMRecord::GOP}.substr(0, size()); }
+    auto overallGCP()   const { return std::string_view{SAMRecord::GCP}.substr(0, size()); }
+
+    auto get_alignment_begin() const { return alignment_begin; }
+    auto get_alignment_end()   const { return alignment_end; }
+    auto get_interval() const { return Interval(record->RNAME, alignment_begin, alignment_end); }
+
+    Cigar cigar() const
+    {
+        auto cigar = record->CIGAR;
+        if (front_reverted) cigar.front().op = CigarOperator::M;
+        if (back_reverted)  cigar.back().op  = CigarOperator::M;
+        return cigar;
+    }
+};
+
+} // hc
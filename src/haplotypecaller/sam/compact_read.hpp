@@ -0,0 +1,219 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <stdexcept>
+#include "sam.hpp"
+#include "sam_record_view.hpp"
+#include "bam_record_view.hpp"
+#include "packed_bases.hpp"
+#include "../utils/quality_utils.hpp"
+
+namespace hc
+{
+
+/** Interns contig names so reads carry a dense id instead of a string. */
+class ContigDictionary
+{
+    std::vector<std::string> names;
+    std::unordered_map<std::string, std::int32_t> ids;
+    std::int32_t last = -1;  // sorted reads repeat one name, which then needs no string or hash
+
+public:
+    std::int32_t intern(std::string_view name)
+    {
+        if (last >= 0 && names[last] == name) return last;
+        auto [it, inserted] = ids.emplace(name, names.size());
+        if (inserted) names.emplace_back(name);
+        return last = it->second;
+    }
+
+    const std::string& name(std::int32_t id) const { return names[id]; }
+    std::size_t size() const { return names.size(); }
+};
+
+/**
+ * Fixed-size, arena-backed form of an alignment record.
+ *
+ * The packed CIGAR (BAM layout), the 4-bit SEQ and QUAL live back to back in
+ * a byte arena owned by the container, starting at data_offset. QNAME is
+ * dropped, contigs are ContigDictionary ids, and the alignment end is
+ * computed once.
+ */
+struct CompactRead
+{
+    static constexpr std::int32_t NO_CONTIG   = -1;  // "*"
+    static constexpr std::int32_t SAME_CONTIG = -2;  // "="
+
+    std::uint64_t data_offset = 0;
+    std::uint32_t begin       = 0;
+    std::uint32_t end         = 0;
+    std::int32_t  contig      = NO_CONTIG;
+    std::int32_t  mate_contig = NO_CONTIG;
+    std::uint32_t PNEXT       = 0;
+    std::int32_t  TLEN        = 0;
+    std::uint32_t length      = 0;
+    std::uint16_t n_cigar     = 0;
+    std::uint16_t FLAG        = 0;
+    std::uint8_t  MAPQ        = 0;
+    std::uint8_t  unused[7]   = {};  // the padding, spelled out so shards hold no stray bytes
+
+    bool READ_UNMAPPED()       const { return (FLAG & 0x4  ) != 0; }
+    bool SECONDARY_ALIGNMENT() const { return (FLAG & 0x100) != 0; }
+    bool DUPLICATE_READ()      const { return (FLAG & 0x400) != 0; }
+
+    std::size_t data_size() const
+    { return n_cigar * sizeof(std::uint32_t) + PackedBases::packed_size(length) + length; }
+
+    /** Appends record's variable-length data to arena and returns its compact header. */
+    static CompactRead pack(const SAMRecord& record, ContigDictionary& contigs, std::vector<std::uint8_t>& arena)
+    {
+        auto read = pack_header(record, contigs);
+        read.end     = record.get_alignment_end();
+        read.length  = record.SEQ.size();
+        read.n_cigar = record.CIGAR.size();
+
+        read.data_offset = arena.size();
+        arena.resize(arena.size() + read.data_size());
+        auto p = arena.data() + read.data_offset;
+        for (auto [length, op] : record.CIGAR)
+            p = pack_cigar_op(length, char(op), record.QNAME, p);
+        pack_bases(record, read.length, p);
+        return read;
+    }
+
+    /** Same as pack(SAMRecord), straight from the text of a SAM line. */
+    static CompactRead pack(const SAMRecordView& record, ContigDictionary& contigs, std::vector<std::uint8_t>& arena)
+    {
+        auto read = pack_header(record, contigs);
+        read.length = record.SEQ.size();
+        auto cigar = record.CIGAR == "*" ? std::string_view() : record.CIGAR;
+        read.n_cigar = std::count_if(cigar.begin(), cigar.end(), [](char c){ return !std::isdigit(static_cast<unsigned char>(c)); });
+
+        read.data_offset = arena.size();
+        arena.resize(arena.size() + read.data_size());
+        auto p = arena.data() + read.data_offset;
+        std::uint32_t length = 0, reference_length = 0;
+        for (auto c : cigar)
+        {
+            if (std::isdigit(static_cast<unsigned char>(c)))
+            {
+                length = length * 10 + (c - '0');
+                continue;
+            }
+            p = pack_cigar_op(length, c, record.QNAME, p);
+            if (std::string_view("MDN=X").find(c) != std::string_view::npos) reference_length += length;
+            length = 0;
+        }
+        read.end = read.begin + reference_length;
+        pack_bases(record, read.length, p);
+        return read;
+    }
+
+    /** Same as pack(SAMRecord), from a BAM record, whose CIGAR and SEQ already have the packed layout. */
+    static CompactRead pack(const BAMRecordView& record, ContigDictionary& contigs, std::vector<std::uint8_t>& arena)
+    {
+        auto read = pack_header(record, contigs);
+        read.length  = record.l_seq;
+        read.n_cigar = record.n_cigar;
+
+        read.data_offset = arena.size();
+        arena.resize(arena.size() + read.data_size());
+        auto p = arena.data() + read.data_offset;
+        std::uint32_t reference_length = 0;
+        for (std::size_t i = 0; i < record.n_cigar; i++)
+        {
+            auto op = record.cigar_op(i);
+            auto code = BAMRecordView::OPERATORS[op & 0xf];
+            p = pack_cigar_op(op >> 4, code, record.QNAME, p);
+            if (std::string_view("MDN=X").find(code) != std::string_view::npos) reference_length += op >> 4;
+        }
+        read.end = read.begin + reference_length;
+
+        auto packed = PackedBases::packed_size(read.length);
+        std::memcpy(p, record.seq, packed);
+        // PackedBases::encode() leaves the low half of an odd last byte 0, BAM need not
+        if (read.length % 2 == 1) p[packed - 1] &= 0xf0;
+        p += packed;
+        if (!record.has_quality())
+            std::memset(p, QualityUtils::ASCII_OFFSET, read.length);
+        else
+            for (std::size_t i = 0; i < read.length; i++)
+                p[i] = record.qual[i] + QualityUtils::ASCII_OFFSET;
+        return read;
+    }
+
+private:
+    /** Every field but end, length and n_cigar, which depend on how the CIGAR and SEQ are held. */
+    template <typename Record>
+    static CompactRead pack_header(const Record& record, ContigDictionary& contigs)
+    {
+        CompactRead read;
+        read.begin       = record.get_alignment_begin();
+        read.contig      = record.RNAME == "*" ? NO_CONTIG : contigs.intern(record.RNAME);
+        read.mate_contig = record.RNEXT == "*" ? NO_CONTIG :
+                           record.RNEXT == "=" ? SAME_CONTIG : contigs.intern(record.RNEXT);
+        read.PNEXT       = record.PNEXT;
+        read.TLEN        = record.TLEN;
+        read.FLAG        = record.FLAG;
+        read.MAPQ        = record.MAPQ;
+        return read;
+    }
+
+    static std::uint8_t* pack_cigar_op(std::uint32_t length, char op, std::string_view qname, std::uint8_t* p)
+    {
+        auto code = std::string_view("MIDNSHP=X").find(op);
+        if (code == std::string_view::npos)
+            throw std::runtime_error("CompactRead: unknown CIGAR operator '" + std::string(1, op) + "' in " + std::string(qname));
+        std::uint32_t packed = length << 4 | code;
+        std::memcpy(p, &packed, sizeof(packed));
+        return p + sizeof(packed);
+    }
+
+    template <typename Record>
+    static void pack_bases(const Record& record, std::size_t length, std::uint8_t* p)
+    {
+        PackedBases::encode(record.SEQ, p);
+        p += PackedBases::packed_size(length);
+        // SAM allows QUAL "*"; keep it as all-missing qualities of SEQ length
+        if (record.QUAL.size() == length)
+            std::memcpy(p, record.QUAL.data(), length);
+        else
+            std::memset(p, QualityUtils::ASCII_OFFSET, length);
+    }
+
+public:
+    void unpack(const ContigDictionary& contigs, const std::uint8_t* arena, SAMRecord& record) const
+    {
+        static const std::string UNMAPPED = "*", SAME = "=";
+        auto p = arena + data_offset;
+
+        std::vector<std::uint32_t> cigar(n_cigar);
+        std::memcpy(cigar.data(), p, n_cigar * sizeof(std::uint32_t));
+        p += n_cigar * sizeof(std::uint32_t);
+
+        record.QNAME.clear();
+        record.FLAG  = FLAG;
+        record.RNAME = contig == NO_CONTIG ? UNMAPPED : contigs.name(contig);
+        record.POS   = begin + 1;
+        record.MAPQ  = MAPQ;
+        record.CIGAR = Cigar(cigar.data(), n_cigar);
+        record.RNEXT = mate_contig == NO_CONTIG ? UNMAPPED :
+                       mate_contig == SAME_CONTIG ? SAME : contigs.name(mate_contig);
+        record.PNEXT = PNEXT;
+        record.TLEN  = TLEN;
+        record.SEQ.resize(length);
+        PackedBases::decode(p, length, record.SEQ.data());
+        p += PackedBases::packed_size(length);
+        record.QUAL.assign(reinterpret_cast<const char*>(p), length);
+    }
+};
+
+} // hc
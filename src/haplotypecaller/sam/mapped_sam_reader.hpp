@@ -0,0 +1,314 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <iterator>
+#include <exception>
+#include <stdexcept>
+#include "sam.hpp"
+#include "sam_record_view.hpp"
+#include "read_source.hpp"
+#include "../utils/mapped_file.hpp"
+#include "../utils/task_runtime.hpp"
+
+namespace hc
+{
+
+/**
+ * SAM reader over a memory-mapped file.
+ *
+ * Lines are split with memchr and parsed into SAMRecordView, whose fields
+ * point into the mapping and stay valid as long as the reader; callers
+ * that pack reads take the views as they are, and a SAMRecord is only
+ * materialised for next(SAMRecord&). With prefilter(), unmapped records
+ * and those the load filters reject are dropped as views. Because the
+ * whole file is addressable, region queries on coordinate-sorted input are
+ * a binary search over line starts, ordered by the @SQ dictionary.
+ *
+ * Given a TaskRuntime with workers, records are parsed in batches:
+ * the next parts * PARALLEL_CHUNK_SIZE bytes are cut at line boundaries
+ * into one range per worker plus one for the caller, the ranges are parsed
+ * through parallel_for() on the runtime shared with the caller's own work,
+ * and the results are concatenated in file order, which keeps them
+ * coordinate-sorted. An error in a range is rethrown to the caller once the
+ * batch is done.
+ */
+class MappedSAMReader : public ReadSource
+{
+    static constexpr std::size_t PARALLEL_CHUNK_SIZE = 4 << 20;
+
+    MappedFile file;
+    std::size_t records_begin = 0;
+    std::size_t cursor = 0;
+    std::vector<std::string> contig_names;
+
+    TaskRuntime* runtime;
+    std::size_t parts_count;  // ranges per batch, 1 parses on the calling thread
+    std::vector<SAMRecordView> batch;
+    std::size_t batch_pos = 0;
+
+    // the batch being parsed: range i is [bounds[i], bounds[i+1])
+    std::vector<std::size_t> bounds;
+    std::vector<std::vector<SAMRecordView>> parts;
+    std::vector<char> in_region_parts;
+    std::vector<LoadReadFilters> part_filters;
+    std::vector<std::exception_ptr> errors;
+
+    // active region query, see query()
+    bool in_region = false;
+    std::string region_contig;
+    std::size_t region_end = 0;
+
+    // see prefilter(); filters is null unless set
+    LoadReadFilters* filters = nullptr;
+    std::string filter_contig;
+
+    std::string_view data() const { return file.view(); }
+
+    std::size_t line_end(std::size_t begin) const
+    {
+        auto nl = static_cast<const char*>(std::memchr(file.data() + begin, '\n', file.size() - begin));
+        return nl == nullptr ? file.size() : nl - file.data();
+    }
+
+    /** First line start at or after offset. */
+    std::size_t line_start(std::size_t offset) const
+    {
+        if (offset <= records_begin) return records_begin;
+        if (file.data()[offset - 1] == '\n') return offset;
+        auto end = line_end(offset);
+        return end == file.size() ? end : end + 1;
+    }
+
+    void read_header()
+    {
+        while (cursor < file.size() && file.data()[cursor] == '@')
+        {
+            auto end = line_end(cursor);
+            auto line = data().substr(cursor, end - cursor);
+            if (line.substr(0, 3) == "@SQ")
+            {
+                if (auto sn = line.find("\tSN:"); sn != std::string_view::npos)
+                {
+                    auto name = line.substr(sn + 4);
+                    contig_names.emplace_back(name.substr(0, name.find_first_of("\t\r")));
+                }
+            }
+            cursor = end == file.size() ? end : end + 1;
+        }
+        records_begin = cursor;
+    }
+
+    std::pair<std::size_t, std::size_t> sort_key(const SAMRecordView& view) const
+    {
+        auto it = std::find(contig_names.begin(), contig_names.end(), view.RNAME);
+        return {it - contig_names.begin(), view.get_alignment_begin()};
+    }
+
+    std::pair<std::size_t, std::size_t> sort_key_at(std::size_t offset) const
+    {
+        SAMRecordView view;
+        if (!view.parse(data().substr(offset, line_end(offset) - offset)))
+            return {std::numeric_limits<std::size_t>::max(), 0};
+        return sort_key(view);
+    }
+
+    /** Offset of the first record whose sort key is not less than key. */
+    std::size_t lower_bound(std::pair<std::size_t, std::size_t> key) const
+    {
+        auto lo = records_begin, hi = file.size();
+        while (true)
+        {
+            auto mid = line_start(lo + (hi - lo) / 2);
+            if (mid <= lo || mid >= hi) break;
+            if (sort_key_at(mid) < key) lo = mid;
+            else hi = mid;
+        }
+        while (lo < hi && sort_key_at(lo) < key)
+        {
+            auto end = line_end(lo);
+            lo = end == file.size() ? end : end + 1;
+        }
+        return std::min(lo, hi);
+    }
+
+    /**
+     * Parses the line at offset, which must be before end, and moves offset
+     * past it. Returns false if the line is blank or past the active region.
+     */
+    bool parse_line(std::size_t& offset, SAMRecordView& view, bool& past_region) const
+    {
+        auto end = line_end(offset);
+        auto line = data().substr(offset, end - offset);
+        offset = end == file.size() ? end : end + 1;
+        if (line.empty() || line == "\r") return false;
+        if (!view.parse(line))
+            throw std::runtime_error("MappedSAMReader: malformed record: " + std::string(line));
+
+        past_region = in_region && (view.RNAME != region_contig || view.get_alignment_begin() >= region_end);
+        return !past_region;
+    }
+
+    /** True if view is to be handed out; chain stands in for filters and is charged instead. */
+    bool keep(const SAMRecordView& view, LoadReadFilters& chain) const
+    {
+        if (filters == nullptr) return true;
+        if (view.READ_UNMAPPED()) return false;
+        return view.RNAME != filter_contig || !chain(view);
+    }
+
+    /** Collects the records kept in [begin, end); returns false once past the active region. */
+    bool parse_range(std::size_t begin, std::size_t end, std::vector<SAMRecordView>& records, LoadReadFilters& chain) const
+    {
+        SAMRecordView view;
+        bool past_region = false;
+        while (begin < end)
+        {
+            if (parse_line(begin, view, past_region))
+            {
+                if (keep(view, chain))
+                    records.push_back(view);
+            }
+            else if (past_region)
+                return false;
+        }
+        return true;
+    }
+
+    void parse_part(std::size_t i)
+    {
+        try
+        { in_region_parts[i] = parse_range(bounds[i], bounds[i+1], parts[i], part_filters[i]); }
+        catch (...)
+        { errors[i] = std::current_exception(); }
+    }
+
+    void parse_batch()
+    {
+        auto length = std::min(file.size() - cursor, parts_count * PARALLEL_CHUNK_SIZE);
+        bounds.assign(1, cursor);
+        for (std::size_t i = 1; i < parts_count; i++)
+            bounds.push_back(std::max(bounds.back(), line_start(cursor + length * i / parts_count)));
+        bounds.push_back(cursor + length == file.size() ? file.size() : line_start(cursor + length));
+
+        for (auto& part : parts) part.clear();
+        std::fill(in_region_parts.begin(), in_region_parts.end(), true);
+        std::fill(errors.begin(), errors.end(), nullptr);
+        if (filters)
+            std::fill(part_filters.begin(), part_filters.end(), filters->without_counts());
+        runtime->parallel_for(parts_count, [this](std::size_t i){ parse_part(i); });
+
+        // a range after the end of the region would not have been read serially
+        for (std::size_t i = 0; i < parts_count; i++)
+        {
+            if (errors[i]) std::rethrow_exception(errors[i]);
+            if (filters) *filters += part_filters[i];
+            if (!in_region_parts[i]) break;
+        }
+
+        batch.clear();
+        batch_pos = 0;
+        std::size_t total = 0;
+        for (const auto& part : parts) total += part.size();
+        batch.reserve(total);
+        for (std::size_t i = 0; i < parts_count; i++)
+        {
+            batch.insert(batch.end(), parts[i].begin(), parts[i].end());
+            if (!in_region_parts[i]) break;
+        }
+        auto past_region = std::find(in_region_parts.begin(), in_region_parts.end(), false) != in_region_parts.end();
+        cursor = past_region ? file.size() : bounds.back();
+    }
+
+public:
+    /** Without a runtime, or one without workers, lines are parsed one at a time on the calling thread. */
+    MappedSAMReader(const std::string& path, TaskRuntime* runtime = nullptr)
+        : file(path), runtime(runtime), parts_count(runtime ? runtime->size() + 1 : 1)
+    {
+        file.advise(MADV_SEQUENTIAL);
+        read_header();
+        parts.resize(parts_count);
+        in_region_parts.resize(parts_count);
+        part_filters.resize(parts_count);
+        errors.resize(parts_count);
+    }
+
+    MappedSAMReader(const MappedSAMReader&) = delete;
+    MappedSAMReader& operator=(const MappedSAMReader&) = delete;
+
+    /** Parses the next line into view; false at end of file or region. */
+    bool next_line(SAMRecordView& view)
+    {
+        bool past_region = false;
+        while (cursor < file.size())
+        {
+            if (parse_line(cursor, view, past_region)) return true;
+            if (past_region) break;
+        }
+        cursor = file.size();
+        return false;
+    }
+
+    bool next(SAMRecord& record) override
+    {
+        SAMRecordView view;
+        if (!next(view)) return false;
+        view.materialize(record);
+        return true;
+    }
+
+    /** Views point into the mapping, so they even outlive later calls. */
+    View views() const override { return View::SAM; }
+
+    bool next(SAMRecordView& view) override
+    {
+        if (parts_count == 1)
+        {
+            do if (!next_line(view)) return false;
+            while (filters && !keep(view, *filters));
+            return true;
+        }
+
+        while (batch_pos == batch.size())
+        {
+            if (cursor >= file.size()) return false;
+            parse_batch();
+        }
+        view = batch[batch_pos++];
+        return true;
+    }
+
+    bool prefilter(const std::string& contig, LoadReadFilters& filters) override
+    {
+        if (this->filters == &filters && filter_contig == contig) return true;
+        this->filters = &filters;
+        filter_contig = contig;
+
+        // the rest of the batch was parsed for another contig and passed contig's reads on unfiltered
+        auto rejected = std::remove_if(batch.begin() + batch_pos, batch.end(),
+            [&](const SAMRecordView& view){ return view.RNAME == contig && filters(view); });
+        batch.erase(rejected, batch.end());
+        return true;
+    }
+
+    /** Requires @SQ lines; returns false for headerless files. */
+    bool query(const std::string& contig, std::size_t begin, std::size_t end) override
+    {
+        auto it = std::find(contig_names.begin(), contig_names.end(), contig);
+        if (it == contig_names.end()) return false;
+
+        cursor = lower_bound({it - contig_names.begin(), begin});
+        batch.clear();
+        batch_pos = 0;
+        in_region = true;
+        region_contig = contig;
+        region_end = end;
+        return true;
+    }
+};
+
+} // hc
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <fstream>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include "read_source.hpp"
+#include "sam_reader.hpp"
+#include "bam_reader.hpp"
+#include "mapped_sam_reader.hpp"
+#include "../utils/task_runtime.hpp"
+
+namespace hc
+{
+
+/**
+ * Opens path as BAM if it starts with a gzip magic number, as SAM otherwise.
+ * Regular SAM files are memory-mapped; pipes and other streams fall back to
+ * the line-by-line SAMReader. BAM decompression and SAM parsing run as tasks
+ * on runtime, which the caller shares with its own work; without one the
+ * reader works on the calling thread.
+ */
+inline std::unique_ptr<ReadSource> open_read_source(const std::string& path, TaskRuntime* runtime = nullptr)
+{
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs)
+        throw std::runtime_error("cannot open " + path);
+
+    // the magic number is put back and the stream handed on: a pipe can be
+    // opened only once, and its first bytes are gone once read
+    char magic[2]{};
+    ifs.read(magic, 2);
+    auto n = ifs.gcount();
+    ifs.clear();
+    while (n-- > 0) ifs.unget();
+    if (magic[0] == '\x1f' && magic[1] == '\x8b')
+        return std::make_unique<BAMReader>(std::move(ifs), path, runtime);
+
+    try
+    { return std::make_unique<MappedSAMReader>(path, runtime); }
+    catch (const std::runtime_error&)
+    { return std::make_unique<SAMReader>(std::move(ifs)); }
+}
+
+} // hc
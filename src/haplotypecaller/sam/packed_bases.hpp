@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+#include <cctype>
+
+namespace hc
+{
+
+/** 4-bit base encoding shared with BAM: "=ACMGRSVTWYHKDBN", two bases per byte, high nibble first. */
+struct PackedBases
+{
+    static constexpr char BASES[] = "=ACMGRSVTWYHKDBN";
+
+    static constexpr std::size_t packed_size(std::size_t length)
+    { return (length + 1) / 2; }
+
+    static void encode(std::string_view bases, std::uint8_t* out)
+    {
+        for (std::size_t i = 0; i < bases.size(); i += 2)
+        {
+            auto hi = codes[static_cast<std::uint8_t>(bases[i])];
+            auto lo = i + 1 < bases.size() ? codes[static_cast<std::uint8_t>(bases[i+1])] : 0;
+            out[i/2] = hi << 4 | lo;
+        }
+    }
+
+    static void decode(const std::uint8_t* packed, std::size_t length, char* out)
+    {
+        for (std::size_t i = 0; i + 1 < length; i += 2)
+        {
+            auto pair = pairs[packed[i/2]];
+            out[i]   = pair[0];
+            out[i+1] = pair[1];
+        }
+        if (length % 2 == 1)
+            out[length-1] = pairs[packed[length/2]][0];
+    }
+
+private:
+    static inline const auto codes = []{
+        std::array<std::uint8_t, 256> table{};
+        table.fill(15);
+        for (std::uint8_t i = 0; i < 16; i++)
+        {
+            table[static_cast<std::uint8_t>(BASES[i])] = i;
+            table[static_cast<std::uint8_t>(std::tolower(BASES[i]))] = i;
+        }
+        return table;
+    }();
+
+    static inline const auto pairs = []{
+        std::array<std::array<char, 2>, 256> table{};
+        for (std::size_t i = 0; i < table.size(); i++)
+            table[i] = {BASES[i >> 4], BASES[i & 0xf]};
+        return table;
+    }();
+};
+
+} // hc
@@ -0,0 +1,218 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <unordered_map>
+#include <stdexcept>
+#include "sam.hpp"
+#include "sam_record_view.hpp"
+#include "bam_record_view.hpp"
+#include "open_read_source.hpp"
+#include "read_index.hpp"
+#include "read_shard.hpp"
+#include "../utils/interval.hpp"
+#include "../utils/read_filter.hpp"
+#include "../utils/task_runtime.hpp"
+
+namespace hc
+{
+
+/**
+ * Sliding window over a coordinate-sorted SAM or BAM stream.
+ *
+ * One buffer serves the whole run: the input is opened once and contigs
+ * are visited through start() in reference dictionary order. Only reads
+ * starting inside the most recently requested region, plus the single
+ * record read ahead of it, are kept in memory. Regions must be requested
+ * in ascending order; reads starting before the current region are
+ * evicted, so peak memory scales with coverage times region size. Reads
+ * failing the read-intrinsic filters are dropped before buffering.
+ *
+ * Seekable sources jump to every region, so their contigs may come in any
+ * order. Others, such as piped SAM or BAM without an index, are streamed
+ * once and must be sorted in reference dictionary order; the read ahead of
+ * a later contig is kept for it.
+ *
+ * A read shard needs no buffering: regions are queried on its mapping, and
+ * its reads were filtered when it was written, with the same filters as
+ * those enabled here or the shard is rejected.
+ */
+class ReadBuffer
+{
+    std::unique_ptr<ReadShard> shard;
+    ReadShard::Contig shard_contig;
+    std::unique_ptr<ReadSource> reader;
+    LoadReadFilters& filters;
+    std::unordered_map<std::string, std::size_t> ranks;
+    std::string contig;
+    std::size_t contig_rank = 0;
+    ReadIndex index;
+    std::size_t kept_from = std::numeric_limits<std::size_t>::max();  // see keep_from()
+    std::size_t evicted_before = 0;
+    SAMRecord pending;
+    SAMRecordView pending_sam;     // pending instead, if the reader hands out views
+    BAMRecordView pending_bam;
+    std::size_t pending_rank = 0;  // never decreases while streaming
+    bool has_pending = false;
+    bool pending_passed = false;   // pending is on contig and passed the filters
+    bool prefiltered = false;      // the reader filters contig's reads, see ReadSource::prefilter()
+    bool exhausted = false;
+    std::string last_name;  // see rank_of()
+    std::size_t last_rank = 0;
+
+    /** Dictionary rank of name, or ranks.size() if it is not a reference contig. */
+    std::size_t rank_of(std::string_view name)
+    {
+        if (name != last_name)
+        {
+            last_name = name;
+            auto it = ranks.find(last_name);
+            last_rank = it == ranks.end() ? ranks.size() : it->second;
+        }
+        return last_rank;
+    }
+
+    /** True if pending, a SAMRecord or a view of one, holds the next read of contig; false at its end. */
+    template <typename Record>
+    bool read_ahead(Record& pending)
+    {
+        while (!exhausted)
+        {
+            if (!has_pending)
+            {
+                if (!reader->next(pending)) { exhausted = true; break; }
+                auto rank = rank_of(pending.RNAME);
+                if (pending.READ_UNMAPPED() || rank == ranks.size()) continue;
+                if (rank < pending_rank)
+                    throw std::runtime_error("ReadBuffer: reads are not sorted in reference dictionary order at " + std::string(pending.QNAME));
+                pending_rank = rank;
+                has_pending = true;
+                pending_passed = prefiltered && pending_rank == contig_rank;
+            }
+            if (pending_rank > contig_rank) return false;
+            if (pending_rank == contig_rank && (pending_passed || !filters(pending)))
+            {
+                pending_passed = true;
+                return true;
+            }
+            has_pending = false;
+        }
+        return false;
+    }
+
+    template <typename Record>
+    void buffer_until(Record& pending, std::size_t end)
+    {
+        while (read_ahead(pending) && pending.get_alignment_begin() < end)
+        {
+            index.push_back(pending);
+            has_pending = false;
+        }
+    }
+
+    /** Packs views straight into the index when the reader has them, so no SAMRecord is built. */
+    void buffer_until(std::size_t end)
+    {
+        switch (reader->views())
+        {
+            case ReadSource::View::SAM: buffer_until(pending_sam, end); break;
+            case ReadSource::View::BAM: buffer_until(pending_bam, end); break;
+            case ReadSource::View::NONE: buffer_until(pending, end); break;
+        }
+    }
+
+public:
+    /**
+     * dictionary lists the reference contigs in order; reads on other
+     * contigs are skipped. runtime is passed on to the reader, see
+     * open_read_source().
+     */
+    ReadBuffer(const std::string& path, const std::vector<std::string>& dictionary, LoadReadFilters& filters,
+               TaskRuntime* runtime = nullptr)
+        : filters(filters)
+    {
+        for (std::size_t i = 0; i < dictionary.size(); i++)
+            ranks.emplace(dictionary[i], i);
+        if (ReadShard::is_shard(path))
+        {
+            shard = std::make_unique<ReadShard>(path);
+            if (shard->load_filters() != filters.enabled_mask())
+                throw std::runtime_error("ReadBuffer: " + path + " was written with other read filters enabled; "
+                                         "pass the --read-filter and --disable-read-filter options used with --write-shard");
+        }
+        else reader = open_read_source(path, runtime);
+    }
+
+    const std::string& contig_name() const { return contig; }
+
+    /** True if reads come from a shard, whose filters ran when it was written. */
+    bool from_shard() const { return shard != nullptr; }
+
+    /** Moves on to name, which must come after the previous contig in the dictionary. */
+    void start(const std::string& name)
+    {
+        contig = name;
+        contig_rank = ranks.at(name);
+        index = ReadIndex{};
+        kept_from = std::numeric_limits<std::size_t>::max();
+        evicted_before = 0;
+        if (shard) shard_contig = shard->contig(contig);
+        else prefiltered = reader->prefilter(contig, filters);
+    }
+
+    /**
+     * Keeps the reads starting at or after pos buffered even once later
+     * regions are requested, so that the next span passed to jump_to() can
+     * start as early as pos.
+     */
+    void keep_from(std::size_t pos) { kept_from = pos; }
+
+    /**
+     * Starts over at span. Seekable sources jump straight to it; others keep
+     * streaming, so span must not start before the reads still buffered,
+     * see keep_from().
+     */
+    void jump_to(const Interval& span)
+    {
+        if (shard) return;
+        if (!reader->query(contig, span.begin, span.end))
+        {
+            if (span.begin < evicted_before)
+                throw std::runtime_error("ReadBuffer: " + span.to_string() + " starts before reads already dropped from a stream");
+            return;
+        }
+        index = ReadIndex{};
+        evicted_before = 0;
+        pending_rank = 0;
+        has_pending = false;
+        exhausted = false;
+    }
+
+    /**
+     * Calls f once per distinct alignment begin inside region, in ascending
+     * order, with all buffered reads that begin there.
+     */
+    template <typename F>
+    void for_each_start(const Interval& region, F&& f)
+    {
+        if (shard)
+        {
+            auto [first, last] = shard_contig.query(region.begin, region.end);
+            for (auto i = first; i != last; i++)
+                f(shard_contig.group(i));
+            return;
+        }
+        evicted_before = std::max(evicted_before, std::min(region.begin, kept_from));
+        index.evict_before(evicted_before);
+        buffer_until(region.end);
+        auto [first, last] = index.query(region.begin, region.end);
+        for (auto i = first; i != last; i++)
+            f(index.group(i));
+    }
+};
+
+} // hc
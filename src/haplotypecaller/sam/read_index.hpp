@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "sam.hpp"
+#include "compact_read.hpp"
+#include "sam_record_view.hpp"
+
+namespace hc
+{
+
+/** Reads of one group together with the arena they point into; indexing materialises a SAMRecord. */
+struct ReadSpan
+{
+    const CompactRead* first = nullptr;
+    const CompactRead* last  = nullptr;
+    const std::uint8_t* arena = nullptr;
+    const ContigDictionary* contigs = nullptr;
+
+    auto begin() const { return first; }
+    auto end()   const { return last; }
+    auto size()  const { return static_cast<std::size_t>(last - first); }
+    bool empty() const { return first == last; }
+
+    void materialize(std::size_t i, SAMRecord& record) const
+    { first[i].unpack(*contigs, arena, record); }
+
+    SAMRecord operator[](std::size_t i) const
+    {
+        SAMRecord record;
+        materialize(i, record);
+        return record;
+    }
+};
+
+/**
+ * Compressed-sparse-row index of reads sorted by alignment begin.
+ *
+ * All reads live in one contiguous array of CompactRead headers whose
+ * variable-length data share one byte arena; begins holds every distinct
+ * alignment begin and offsets[i]..offsets[i+1] delimits the reads starting
+ * at begins[i]. A region query is two binary searches over begins.
+ */
+class ReadIndex
+{
+    ContigDictionary contigs;
+    std::vector<CompactRead> reads;
+    std::vector<std::uint8_t> arena;
+    std::vector<std::size_t> begins;
+    std::vector<std::size_t> offsets{0};
+    std::size_t first_group = 0;
+
+    void compact()
+    {
+        auto base = offsets[first_group];
+        auto arena_base = base < reads.size() ? reads[base].data_offset : arena.size();
+        reads.erase(reads.begin(), reads.begin() + base);
+        arena.erase(arena.begin(), arena.begin() + arena_base);
+        begins.erase(begins.begin(), begins.begin() + first_group);
+        offsets.erase(offsets.begin(), offsets.begin() + first_group);
+        for (auto& offset : offsets) offset -= base;
+        for (auto& read : reads) read.data_offset -= arena_base;
+        first_group = 0;
+    }
+
+public:
+    /** Appends a SAMRecord or SAMRecordView; reads must arrive in non-decreasing alignment begin. */
+    template <typename Record>
+    void push_back(const Record& record)
+    {
+        auto begin = record.get_alignment_begin();
+        if (begins.empty() || begins.back() != begin)
+        {
+            if (!begins.empty() && begin < begins.back())
+                throw std::runtime_error("ReadIndex: input is not coordinate-sorted");
+            begins.push_back(begin);
+            offsets.push_back(offsets.back());
+        }
+        reads.push_back(CompactRead::pack(record, contigs, arena));
+        offsets.back()++;
+    }
+
+    /** Drops every group starting before begin. */
+    void evict_before(std::size_t begin)
+    {
+        first_group = std::lower_bound(begins.begin() + first_group, begins.end(), begin) - begins.begin();
+        if (first_group * 2 > begins.size()) compact();
+    }
+
+    /** Returns the group range [first, last) of reads starting in [begin, end). */
+    std::pair<std::size_t, std::size_t> query(std::size_t begin, std::size_t end) const
+    {
+        auto lo = std::lower_bound(begins.begin() + first_group, begins.end(), begin);
+        auto hi = std::lower_bound(lo, begins.end(), end);
+        return {lo - begins.begin(), hi - begins.begin()};
+    }
+
+    ReadSpan group(std::size_t i) const
+    { return {reads.data() + offsets[i], reads.data() + offsets[i+1], arena.data(), &contigs}; }
+
+    ReadSpan reads_in(std::pair<std::size_t, std::size_t> groups) const
+    { return {reads.data() + offsets[groups.first], reads.data() + offsets[groups.second], arena.data(), &contigs}; }
+
+    void materialize(const CompactRead& read, SAMRecord& record) const
+    { read.unpack(contigs, arena.data(), record); }
+
+    std::size_t group_begin(std::size_t i) const { return begins[i]; }
+    std::size_t size()  const { return reads.size() - offsets[first_group]; }
+    bool empty() const { return size() == 0; }
+};
+
+} // hc
@@ -0,0 +1,326 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <sys/stat.h>
+#include "sam.hpp"
+#include "compact_read.hpp"
+#include "read_index.hpp"
+#include "read_source.hpp"
+#include "../utils/mapped_file.hpp"
+#include "../utils/read_filter.hpp"
+
+namespace hc
+{
+
+/**
+ * On-disk layout of a read shard: filtered reads in CompactRead form,
+ * position-indexed per contig, laid out so that a memory mapping of the file
+ * can be queried in place.
+ *
+ *   ShardHeader
+ *   arena       variable-length read data, CompactRead::data_offset is relative to it
+ *   reads       CompactRead[read_count], sorted by contig then alignment begin
+ *   begins      uint64[group_count], distinct alignment begins per contig
+ *   offsets     uint64[group_count + contig_count], CSR offsets into reads, one sentinel per contig
+ *   contigs     ShardContig[contig_count], the contigs that have reads
+ *   names       ContigDictionary of the reads, NUL-terminated names in id order
+ *
+ * The dictionary also holds contigs named only as a mate's RNEXT, so a
+ * contig's id can be larger than those of contigs after it. Every section
+ * starts 8-byte aligned. load_filters records which LoadReadFilters were
+ * enabled while writing, as LoadReadFilters::enabled_mask(). The format is
+ * bumped through VERSION whenever CompactRead, any section or the order of
+ * LoadReadFilters changes.
+ */
+struct ShardHeader
+{
+    static constexpr char MAGIC[8] = {'H', 'C', 'S', 'H', 'A', 'R', 'D', '\0'};
+    static constexpr std::uint32_t VERSION = 4;
+
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t read_size;
+    std::uint64_t arena_offset, arena_size;
+    std::uint64_t reads_offset, read_count;
+    std::uint64_t begins_offset, group_count;
+    std::uint64_t offsets_offset;
+    std::uint64_t contigs_offset, contig_count;
+    std::uint64_t names_offset, names_size, name_count;
+    std::uint64_t load_filters;
+};
+
+struct ShardContig
+{
+    std::uint64_t id;  // in the dictionary
+    std::uint64_t first_group, group_count;
+};
+
+/** Writes the mapped reads of a source that pass the load filters into a shard. */
+class ReadShardWriter
+{
+    static constexpr std::size_t ALIGNMENT = 8;
+
+    // sections other than the arena are spooled to temporary files and appended at the end
+    struct Spool
+    {
+        std::unique_ptr<std::FILE, decltype(&std::fclose)> file{std::tmpfile(), &std::fclose};
+
+        Spool()
+        {
+            if (!file)
+                throw std::runtime_error("ReadShardWriter: cannot create temporary file");
+        }
+
+        void write(const void* data, std::size_t n)
+        {
+            if (std::fwrite(data, 1, n, file.get()) != n)
+                throw std::runtime_error("ReadShardWriter: write failed");
+        }
+
+        void copy_to(std::ofstream& ofs)
+        {
+            std::rewind(file.get());
+            std::vector<char> buffer(1 << 20);
+            std::size_t n;
+            while ((n = std::fread(buffer.data(), 1, buffer.size(), file.get())) > 0)
+                ofs.write(buffer.data(), n);
+        }
+    };
+
+    static void pad(std::ofstream& ofs)
+    {
+        static constexpr char zeros[ALIGNMENT]{};
+        auto misalignment = static_cast<std::size_t>(ofs.tellp()) % ALIGNMENT;
+        if (misalignment != 0) ofs.write(zeros, ALIGNMENT - misalignment);
+    }
+
+public:
+    static void write(ReadSource& source, const std::string& path, LoadReadFilters& filters)
+    {
+        std::ofstream ofs(path, std::ios::binary);
+        if (!ofs)
+            throw std::runtime_error("ReadShardWriter: cannot open " + path);
+
+        ShardHeader header{};
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        header.arena_offset = ofs.tellp();
+
+        Spool reads, begins, offsets;
+        std::vector<ShardContig> contigs;
+        std::vector<bool> started;  // by dictionary id, whether reads on the contig were seen
+        ContigDictionary dictionary;
+        std::vector<std::uint8_t> arena;
+        std::uint64_t arena_size = 0, read_count = 0, group_count = 0;
+
+        auto close_contig = [&]{
+            if (contigs.empty()) return;
+            offsets.write(&read_count, sizeof(read_count));
+            contigs.back().group_count = group_count - contigs.back().first_group;
+        };
+
+        std::uint64_t last_begin = 0;
+        auto add = [&](const auto& record){
+            if (record.READ_UNMAPPED() || filters(record)) return;
+
+            // a mate's RNEXT may have interned a contig before its own reads, so order is checked on RNAME alone
+            std::uint64_t contig = dictionary.intern(record.RNAME);
+            if (contigs.empty() || contig != contigs.back().id)
+            {
+                started.resize(std::max<std::size_t>(started.size(), contig + 1));
+                if (started[contig])
+                    throw std::runtime_error("ReadShardWriter: input is not coordinate-sorted");
+                started[contig] = true;
+                close_contig();
+                contigs.push_back({contig, group_count, 0});
+                last_begin = std::numeric_limits<std::uint64_t>::max();
+            }
+
+            std::uint64_t begin = record.get_alignment_begin();
+            if (begin != last_begin)
+            {
+                if (last_begin != std::numeric_limits<std::uint64_t>::max() && begin < last_begin)
+                    throw std::runtime_error("ReadShardWriter: input is not coordinate-sorted");
+                begins.write(&begin, sizeof(begin));
+                offsets.write(&read_count, sizeof(read_count));
+                last_begin = begin;
+                group_count++;
+            }
+
+            arena.clear();
+            auto read = CompactRead::pack(record, dictionary, arena);
+            read.data_offset = arena_size;
+            ofs.write(reinterpret_cast<const char*>(arena.data()), arena.size());
+            arena_size += arena.size();
+            reads.write(&read, sizeof(read));
+            read_count++;
+        };
+        // views are packed as they are, without building a SAMRecord
+        auto add_all = [&](auto record){ while (source.next(record)) add(record); };
+        switch (source.views())
+        {
+            case ReadSource::View::SAM: add_all(SAMRecordView{}); break;
+            case ReadSource::View::BAM: add_all(BAMRecordView{}); break;
+            case ReadSource::View::NONE: add_all(SAMRecord{}); break;
+        }
+        close_contig();
+
+        header.arena_size = arena_size;
+        pad(ofs);
+        header.reads_offset = ofs.tellp();
+        header.read_count = read_count;
+        reads.copy_to(ofs);
+        header.begins_offset = ofs.tellp();
+        header.group_count = group_count;
+        begins.copy_to(ofs);
+        header.offsets_offset = ofs.tellp();
+        offsets.copy_to(ofs);
+
+        std::string name_blob;
+        for (std::size_t i = 0; i < dictionary.size(); i++)
+            name_blob.append(dictionary.name(i)).push_back('\0');
+        header.contigs_offset = ofs.tellp();
+        header.contig_count = contigs.size();
+        ofs.write(reinterpret_cast<const char*>(contigs.data()), contigs.size() * sizeof(ShardContig));
+        header.names_offset = ofs.tellp();
+        header.names_size = name_blob.size();
+        header.name_count = dictionary.size();
+        ofs.write(name_blob.data(), name_blob.size());
+
+        std::memcpy(header.magic, ShardHeader::MAGIC, sizeof(header.magic));
+        header.version = ShardHeader::VERSION;
+        header.read_size = sizeof(CompactRead);
+        header.load_filters = filters.enabled_mask();
+        ofs.seekp(0);
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!ofs)
+            throw std::runtime_error("ReadShardWriter: write failed");
+    }
+};
+
+/** Memory-mapped read shard; queries run directly on the mapping. */
+class ReadShard
+{
+    MappedFile file;
+    const ShardHeader* header;
+    const CompactRead* reads;
+    const std::uint64_t* begins;
+    const std::uint64_t* offsets;
+    const ShardContig* contigs;
+    ContigDictionary dictionary;
+
+    /** count Ts at offset; throws unless they lie inside the file. */
+    template <typename T>
+    const T* section(const std::string& path, std::uint64_t offset, std::uint64_t count) const
+    {
+        if (offset > file.size() || offset % alignof(T) != 0 || count > (file.size() - offset) / sizeof(T))
+            throw std::runtime_error("ReadShard: " + path + " is truncated or corrupt");
+        return reinterpret_cast<const T*>(file.data() + offset);
+    }
+
+public:
+    /** A contig of the shard, with the same query interface as ReadIndex. */
+    struct Contig
+    {
+        const ReadShard* shard = nullptr;
+        const std::uint64_t* begins = nullptr;
+        const std::uint64_t* offsets = nullptr;
+        std::size_t group_count = 0;
+
+        std::pair<std::size_t, std::size_t> query(std::size_t begin, std::size_t end) const
+        {
+            auto lo = std::lower_bound(begins, begins + group_count, begin);
+            auto hi = std::lower_bound(lo, begins + group_count, end);
+            return {lo - begins, hi - begins};
+        }
+
+        ReadSpan group(std::size_t i) const
+        { return {shard->reads + offsets[i], shard->reads + offsets[i+1], shard->arena(), &shard->dictionary}; }
+    };
+
+    /** Shards are memory-mapped, so pipes are never shards and are left unread. */
+    static bool is_shard(const std::string& path)
+    {
+        struct stat st{};
+        if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+        std::ifstream ifs(path, std::ios::binary);
+        char magic[sizeof(ShardHeader::MAGIC)]{};
+        ifs.read(magic, sizeof(magic));
+        return ifs && std::memcmp(magic, ShardHeader::MAGIC, sizeof(magic)) == 0;
+    }
+
+    /**
+     * Checks every section and the per-contig index against the file size,
+     * so that a truncated or corrupt shard throws here instead of being read
+     * out of bounds. The payload of each read is not checked.
+     */
+    ReadShard(const std::string& path) : file(path)
+    {
+        if (file.size() < sizeof(ShardHeader) || std::memcmp(file.data(), ShardHeader::MAGIC, sizeof(ShardHeader::MAGIC)) != 0)
+            throw std::runtime_error("ReadShard: " + path + " is not a read shard");
+        header = section<ShardHeader>(path, 0, 1);
+        if (header->version != ShardHeader::VERSION || header->read_size != sizeof(CompactRead))
+            throw std::runtime_error("ReadShard: " + path + " was written by an incompatible version");
+
+        auto corrupt = [&]{ return std::runtime_error("ReadShard: " + path + " is truncated or corrupt"); };
+        const auto& h = *header;
+        if (h.contig_count > std::numeric_limits<std::uint64_t>::max() - h.group_count) throw corrupt();
+        section<std::uint8_t>(path, h.arena_offset, h.arena_size);
+        reads   = section<CompactRead>  (path, h.reads_offset,   h.read_count);
+        begins  = section<std::uint64_t>(path, h.begins_offset,  h.group_count);
+        offsets = section<std::uint64_t>(path, h.offsets_offset, h.group_count + h.contig_count);
+        contigs = section<ShardContig>  (path, h.contigs_offset, h.contig_count);
+        auto names = section<char>(path, h.names_offset, h.names_size);
+
+        for (std::uint64_t i = 0, offset = 0; i < h.name_count; i++)
+        {
+            auto end = static_cast<const char*>(std::memchr(names + offset, '\0', h.names_size - offset));
+            if (end == nullptr) throw corrupt();
+            dictionary.intern(std::string(names + offset, end));
+            offset = end - names + 1;
+        }
+        // names are distinct, so ids match the writer's
+        if (dictionary.size() != h.name_count) throw corrupt();
+
+        // contig i owns groups [first_group, first_group + group_count) and offsets one past them
+        for (std::uint64_t i = 0; i < h.contig_count; i++)
+        {
+            const auto& contig = contigs[i];
+            if (contig.id >= h.name_count || contig.first_group > h.group_count ||
+                contig.group_count > h.group_count - contig.first_group)
+                throw corrupt();
+            auto first = offsets + contig.first_group + i;
+            for (auto it = first; it != first + contig.group_count; ++it)
+                if (it[0] > it[1] || it[1] > h.read_count) throw corrupt();
+            if (first[0] > h.read_count) throw corrupt();
+        }
+    }
+
+    /** The load filters the reads passed, see ShardHeader::load_filters. */
+    std::uint64_t load_filters() const { return header->load_filters; }
+
+    const std::uint8_t* arena() const
+    { return reinterpret_cast<const std::uint8_t*>(file.data() + header->arena_offset); }
+
+    /** Reads of contig name; empty if the shard has none. */
+    Contig contig(const std::string& name) const
+    {
+        for (std::size_t i = 0; i < header->contig_count; i++)
+        {
+            const auto& contig = contigs[i];
+            if (dictionary.name(contig.id) == name)
+                return {this, begins + contig.first_group, offsets + contig.first_group + i, contig.group_count};
+        }
+        return {this};
+    }
+};
+
+} // hc
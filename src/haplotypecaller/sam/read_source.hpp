@@ -0,0 +1,53 @@
+#pragma once
+
+#include <string>
+#include "sam.hpp"
+#include "sam_record_view.hpp"
+#include "bam_record_view.hpp"
+#include "../utils/read_filter.hpp"
+
+namespace hc
+{
+
+/** A coordinate-sorted stream of alignment records. */
+struct ReadSource
+{
+    virtual ~ReadSource() = default;
+
+    /** Reads the next record, returns false at end of input. */
+    virtual bool next(SAMRecord& record) = 0;
+
+    enum class View { NONE, SAM, BAM };
+
+    /**
+     * Which of the next() overloads below may be used instead, to look at
+     * a record without building it. A view stays valid until the next call
+     * to next() or query().
+     */
+    virtual View views() const { return View::NONE; }
+
+    /** Like next(SAMRecord&); only if views() is View::SAM. */
+    virtual bool next(SAMRecordView&) { return false; }
+
+    /** Like next(SAMRecord&); only if views() is View::BAM. */
+    virtual bool next(BAMRecordView&) { return false; }
+
+    /**
+     * Restricts next() to records on contig whose alignment begins in [begin, end).
+     * Returns false if the source cannot seek, in which case it is unchanged.
+     */
+    virtual bool query(const std::string&, std::size_t, std::size_t)
+    { return false; }
+
+    /**
+     * Lets the source drop the records the caller would drop before building
+     * them: unmapped records, and records on contig that filters reject,
+     * which are charged to filters. Records on other contigs are passed on
+     * unfiltered. Returns false if the source cannot, in which case it is
+     * unchanged and the caller filters.
+     */
+    virtual bool prefilter(const std::string&, LoadReadFilters&)
+    { return false; }
+};
+
+} // hc
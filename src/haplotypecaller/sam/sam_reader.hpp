@@ -0,0 +1,50 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include "sam.hpp"
+#include "read_source.hpp"
+
+namespace hc
+{
+
+struct SAMReader : ReadSource
+{
+private:
+    std::ifstream ifs;
+    std::string line;
+
+    static std::ifstream open(const std::string& path)
+    {
+        std::ifstream ifs(path);
+        if (!ifs)
+            throw std::runtime_error("SAMReader: cannot open " + path);
+        return ifs;
+    }
+
+public:
+    SAMReader(const std::string& path) : SAMReader(open(path)) {}
+
+    /** Reads from a stream already opened, e.g. a pipe that cannot be opened twice. */
+    SAMReader(std::ifstream ifs) : ifs(std::move(ifs))
+    {
+        // skip header, keep the first record line buffered
+        while (std::getline(this->ifs, line) && !line.empty() && line[0] == '@');
+    }
+
+    bool next(SAMRecord& record) override
+    {
+        while (line.empty())
+            if (!std::getline(ifs, line))
+                return false;
+
+        std::istringstream iss(line);
+        iss >> record;
+        line.clear();
+        return true;
+    }
+};
+
+} // hc
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <string_view>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include "sam.hpp"
+
+namespace hc
+{
+
+/**
+ * One SAM line split into its eleven mandatory fields without copying:
+ * every string field points into the parsed buffer, numeric fields are
+ * parsed locale-free. materialize() produces an owning SAMRecord.
+ */
+struct SAMRecordView
+{
+    std::string_view QNAME;
+    std::uint16_t    FLAG = 0;
+    std::string_view RNAME;
+    std::uint32_t    POS = 0;
+    std::uint16_t    MAPQ = 0;
+    std::string_view CIGAR;
+    std::string_view RNEXT;
+    std::uint32_t    PNEXT = 0;
+    std::int32_t     TLEN = 0;
+    std::string_view SEQ;
+    std::string_view QUAL;
+
+    bool READ_UNMAPPED()                   const { return (FLAG & 0x4  ) != 0; }
+    bool SECONDARY_ALIGNMENT()             const { return (FLAG & 0x100) != 0; }
+    bool READ_FAILS_VENDOR_QUALITY_CHECK() const { return (FLAG & 0x200) != 0; }
+    bool DUPLICATE_READ()                  const { return (FLAG & 0x400) != 0; }
+    bool SUPPLEMENTARY_ALIGNMENT()         const { return (FLAG & 0x800) != 0; }
+    auto get_alignment_begin() const { return POS - 1; }
+
+    /** Bases the CIGAR takes from SEQ: the lengths of its M, I, S, = and X operations. */
+    std::size_t get_cigar_read_length() const
+    {
+        std::size_t read_length = 0, length = 0;
+        for (auto c : CIGAR)
+        {
+            if (c >= '0' && c <= '9') length = length * 10 + (c - '0');
+            else
+            {
+                if (std::string_view("MIS=X").find(c) != std::string_view::npos) read_length += length;
+                length = 0;
+            }
+        }
+        return read_length;
+    }
+
+private:
+    static std::string_view next_field(const char*& p, const char* end)
+    {
+        auto tab = static_cast<const char*>(std::memchr(p, '\t', end - p));
+        auto field_end = tab == nullptr ? end : tab;
+        std::string_view field(p, field_end - p);
+        p = tab == nullptr ? end : tab + 1;
+        return field;
+    }
+
+    template <typename T>
+    static bool next_number(const char*& p, const char* end, T& value)
+    {
+        auto [ptr, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc{} || (ptr != end && *ptr != '\t')) return false;
+        p = ptr == end ? end : ptr + 1;
+        return true;
+    }
+
+public:
+    /** Parses one line without its trailing newline; returns false if it is malformed. */
+    bool parse(std::string_view line)
+    {
+        if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+        auto p = line.data(), end = line.data() + line.size();
+
+        QNAME = next_field(p, end);
+        if (!next_number(p, end, FLAG)) return false;
+        RNAME = next_field(p, end);
+        if (!next_number(p, end, POS)) return false;
+        if (!next_number(p, end, MAPQ)) return false;
+        CIGAR = next_field(p, end);
+        RNEXT = next_field(p, end);
+        if (!next_number(p, end, PNEXT)) return false;
+        if (!next_number(p, end, TLEN)) return false;
+        SEQ  = next_field(p, end);
+        QUAL = next_field(p, end);
+        return !QUAL.empty();
+    }
+
+    void materialize(SAMRecord& record) const
+    {
+        record.QNAME.assign(QNAME);
+        record.FLAG = FLAG;
+        record.RNAME.assign(RNAME);
+        record.POS  = POS;
+        record.MAPQ = MAPQ;
+        record.CIGAR = CIGAR == "*" ? Cigar{} : Cigar{CIGAR};
+        record.RNEXT.assign(RNEXT);
+        record.PNEXT = PNEXT;
+        record.TLEN  = TLEN;
+        record.SEQ.assign(SEQ);
+        record.QUAL.assign(QUAL);
+    }
+};
+
+} // hc
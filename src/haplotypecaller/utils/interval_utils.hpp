@@ -0,0 +1,129 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include "interval.hpp"
+
+namespace hc
+{
+
+struct IntervalUtils
+{
+    static bool ends_with(const std::string& str, const std::string& suffix)
+    { return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0; }
+
+    /** BED: 0-based, half-open. */
+    static void load_bed(const std::string& path, std::vector<Interval>& intervals)
+    {
+        std::ifstream ifs(path);
+        if (!ifs)
+            throw std::runtime_error("IntervalUtils: cannot open " + path);
+
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            if (line.empty() || line[0] == '#' || line.compare(0, 5, "track") == 0 || line.compare(0, 7, "browser") == 0)
+                continue;
+            std::istringstream iss(line);
+            std::string contig;
+            std::size_t begin, end;
+            if (!(iss >> contig >> begin >> end))
+                throw std::runtime_error("IntervalUtils: malformed BED line: " + line);
+            intervals.emplace_back(contig, begin, end);
+        }
+    }
+
+    /** Picard interval list: SAM-style header, then 1-based closed intervals. */
+    static void load_interval_list(const std::string& path, std::vector<Interval>& intervals)
+    {
+        std::ifstream ifs(path);
+        if (!ifs)
+            throw std::runtime_error("IntervalUtils: cannot open " + path);
+
+        std::string line;
+        while (std::getline(ifs, line))
+        {
+            if (line.empty() || line[0] == '@') continue;
+            std::istringstream iss(line);
+            std::string contig;
+            std::size_t begin, end;
+            if (!(iss >> contig >> begin >> end) || begin == 0)
+                throw std::runtime_error("IntervalUtils: malformed interval list line: " + line);
+            intervals.emplace_back(contig, begin - 1, end);
+        }
+    }
+
+    /** GATK interval file: one interval string per line. */
+    static void load_gatk_list(const std::string& path, std::vector<Interval>& intervals)
+    {
+        std::ifstream ifs(path);
+        if (!ifs)
+            throw std::runtime_error("IntervalUtils: cannot open " + path);
+
+        std::string line;
+        while (std::getline(ifs, line))
+            if (!line.empty() && line[0] != '#')
+                intervals.push_back(parse(line));
+    }
+
+    /** chr, chr:begin, chr:begin+ or chr:begin-end, 1-based closed. */
+    static Interval parse(const std::string& str)
+    {
+        Interval interval(str.c_str());
+        if (interval.begin > 0) interval.begin--;
+        // chr:POS already spans one base from POS, which moved with begin
+        auto colon = str.find(Interval::CONTIG_SEPARATOR);
+        if (colon != std::string::npos && str.find(Interval::BEGIN_END_SEPARATOR, colon) == std::string::npos
+                                       && str.back() != Interval::END_OF_CONTIG)
+            interval.end = interval.begin + 1;
+        return interval;
+    }
+
+    /** Sorts by contig order of first appearance, then position, and merges overlapping or abutting intervals. */
+    static std::vector<Interval> merge(std::vector<Interval> intervals)
+    {
+        std::vector<std::string> contigs;
+        for (const auto& interval : intervals)
+            if (std::find(contigs.begin(), contigs.end(), interval.contig) == contigs.end())
+                contigs.push_back(interval.contig);
+        auto rank = [&](const auto& contig){ return std::find(contigs.begin(), contigs.end(), contig) - contigs.begin(); };
+        std::stable_sort(intervals.begin(), intervals.end(), [&](const auto& lhs, const auto& rhs){
+            return std::make_pair(rank(lhs.contig), lhs.begin) < std::make_pair(rank(rhs.contig), rhs.begin);
+        });
+
+        std::vector<Interval> merged;
+        for (auto& interval : intervals)
+        {
+            if (!merged.empty() && merged.back().contig == interval.contig && interval.begin <= merged.back().end)
+                merged.back().end = std::max(merged.back().end, interval.end);
+            else
+                merged.push_back(std::move(interval));
+        }
+        return merged;
+    }
+
+    /** Resolves -L arguments: interval strings, .bed, .interval_list or .intervals/.list files. */
+    static std::vector<Interval> load(const std::vector<std::string>& args)
+    {
+        std::vector<Interval> intervals;
+        for (const auto& arg : args)
+        {
+            if (ends_with(arg, ".bed"))
+                load_bed(arg, intervals);
+            else if (ends_with(arg, ".interval_list"))
+                load_interval_list(arg, intervals);
+            else if (ends_with(arg, ".intervals") || ends_with(arg, ".list"))
+                load_gatk_list(arg, intervals);
+            else
+                intervals.push_back(parse(arg));
+        }
+        return merge(std::move(intervals));
+    }
+};
+
+} // hc
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace hc
+{
+
+/** Read-only memory mapping of a whole file. */
+class MappedFile
+{
+    const char* data_ = nullptr;
+    std::size_t size_ = 0;
+
+public:
+    MappedFile(const std::string& path)
+    {
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("MappedFile: cannot open " + path);
+
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            ::close(fd);
+            throw std::runtime_error("MappedFile: " + path + " is not a regular file");
+        }
+
+        size_ = st.st_size;
+        if (size_ > 0)
+        {
+            auto addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                ::close(fd);
+                throw std::runtime_error("MappedFile: cannot map " + path);
+            }
+            data_ = static_cast<const char*>(addr);
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        if (data_ != nullptr)
+            ::munmap(const_cast<char*>(data_), size_);
+    }
+
+    /** Hints the kernel about the access pattern of [offset, offset + length). */
+    void advise(int advice, std::size_t offset = 0, std::size_t length = 0) const
+    {
+        if (data_ == nullptr) return;
+        auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        auto begin = offset / page * page;
+        if (length == 0) length = size_ - offset;
+        ::madvise(const_cast<char*>(data_) + begin, offset + length - begin, advice);
+    }
+
+    const char* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    std::string_view view() const { return {data_, size_}; }
+};
+
+} // hc
@@ -2,6 +2,8 @@
 
 #include <array>
 #include <cmath>
+#include <vector>
+#include <memory_resource>
 
 namespace hc
 {
@@ -32,4 +34,7 @@ private:
     };
 };
 
+/** Log10 likelihoods with one row per read, allocated from a region's memory resource. */
+using LikelihoodMatrix = std::pmr::vector<std::pmr::vector<double>>;
+
 } // hc
\ No newline at end of file
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include "../sam/read_index.hpp"
+
+namespace hc
+{
+
+/**
+ * Keeps at most max_reads of the reads sharing an alignment start; as in
+ * GATK, max_reads = 0 keeps them all.
+ *
+ * Selection is reservoir sampling over the group, one random draw per read.
+ * The generator is re-keyed for every start from the global seed, the contig
+ * and the position, so the choice depends neither on thread count nor on
+ * how the contig is scanned, and the same seed always picks the same reads.
+ */
+class PositionalDownsampler
+{
+    std::size_t max_reads;
+    std::uint64_t seed;
+    std::vector<std::size_t> reservoir;
+
+    /** splitmix64: a full-period generator whose state is also a good hash. */
+    struct Random
+    {
+        std::uint64_t state;
+
+        std::uint64_t next()
+        {
+            auto z = (state += 0x9e3779b97f4a7c15ULL);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+        /** Uniform in [0, n), by multiply-shift. */
+        std::size_t below(std::size_t n)
+        { return static_cast<std::size_t>((static_cast<unsigned __int128>(next()) * n) >> 64); }
+    };
+
+    /** 64-bit FNV-1a; unlike std::hash it is the same under every standard library. */
+    static std::uint64_t hash(std::string_view bytes)
+    {
+        std::uint64_t h = 0xcbf29ce484222325ULL;
+        for (auto c : bytes)
+            h = (h ^ static_cast<std::uint8_t>(c)) * 0x100000001b3ULL;
+        return h;
+    }
+
+public:
+    PositionalDownsampler(std::size_t max_reads, std::uint64_t seed)
+        : max_reads(max_reads), seed(seed) {}
+
+    /** Materialises the selected reads of one start group, in input order, through emit(SAMRecord&&). */
+    template <typename F>
+    void sample(const std::string& contig, const ReadSpan& reads, F&& emit)
+    {
+        if (reads.empty()) return;
+
+        reservoir.clear();
+        if (max_reads == 0 || reads.size() <= max_reads)
+            for (std::size_t i = 0; i < reads.size(); i++) reservoir.push_back(i);
+        else
+        {
+            Random random{seed ^ hash(contig) ^ (std::uint64_t(reads.begin()->begin) << 32)};
+            random.next();
+            for (std::size_t i = 0; i < reads.size(); i++)
+            {
+                if (i < max_reads) reservoir.push_back(i);
+                else if (auto j = random.below(i + 1); j < max_reads) reservoir[j] = i;
+            }
+            std::sort(reservoir.begin(), reservoir.end());
+        }
+
+        for (auto i : reservoir)
+        {
+            SAMRecord record;
+            reads.materialize(i, record);
+            emit(std::move(record));
+        }
+    }
+};
+
+} // hc
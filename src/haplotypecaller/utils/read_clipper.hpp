@@ -1,93 +1,71 @@
 #pragma once
 
 #include "../sam/sam.hpp"
+#include "../sam/clipped_read.hpp"
 #include "../utils/interval.hpp"
 
 namespace hc
 {
 
+/** Clips by moving the offsets of a ClippedRead; SEQ and QUAL are never copied. */
 struct ReadClipper
 {
-    static void hard_clip_soft_clipped_bases(SAMRecord& read)
+    static ClippedRead hard_clip_soft_clipped_bases(ClippedRead read)
     {
-        auto& seq  = read.SEQ;
-        auto& qual = read.QUAL;
-        const auto& cigar = read.CIGAR;
+        const auto& cigar = read.record->CIGAR;
 
         auto [front_length, front_op] = cigar.front();
         if (front_op == CigarOperator::S)
-        {
-            seq  = seq. substr(front_length);
-            qual = qual.substr(front_length);
-        }
+            read.begin += front_length;
 
         auto [back_length, back_op] = cigar.back();
         if (back_op == CigarOperator::S)
-        {
-            seq  = seq. substr(0, seq. size()-back_length);
-            qual = qual.substr(0, qual.size()-back_length);
-        }
+            read.end -= back_length;
+        return read;
     }
 
-    static void revert_soft_clipped_bases(SAMRecord& read)
+    static ClippedRead revert_soft_clipped_bases(ClippedRead read)
     {
-        auto& seq  = read.SEQ;
-        auto& qual = read.QUAL;
-        auto& cigar = read.CIGAR;
+        const auto& cigar = read.record->CIGAR;
 
-        if (read.READ_REVERSE_STRAND())
+        if (read.record->READ_REVERSE_STRAND())
         {
             auto [front_length, front_op] = cigar.front();
             if (front_op == CigarOperator::S)
-            {
-                seq  = seq. substr(front_length);
-                qual = qual.substr(front_length);
-            }
+                read.begin += front_length;
             auto [back_length, back_op] = cigar.back();
             if (back_op == CigarOperator::S)
-                cigar.back() = {back_length, CigarOperator::M};
+            {
+                read.back_reverted = true;
+                read.alignment_end += back_length;
+            }
         }
         else
         {
             auto [front_length, front_op] = cigar.front();
-            auto alignment_begin = read.get_alignment_begin();
-            if (front_op == CigarOperator::S && alignment_begin >= front_length)
+            if (front_op == CigarOperator::S && read.alignment_begin >= front_length)
             {
-                cigar.front() = {front_length, CigarOperator::M};
-                read.POS = alignment_begin - front_length + 1;
+                read.front_reverted = true;
+                read.alignment_begin -= front_length;
             }
+            // with a single element the front was the back, and it is no longer a soft clip
             auto [back_length, back_op] = cigar.back();
-            if (back_op == CigarOperator::S)
-            {
-                seq  = seq. substr(0, seq. size()-back_length);
-                qual = qual.substr(0, qual.size()-back_length);
-            }
+            if (back_op == CigarOperator::S && !(read.front_reverted && cigar.size() == 1))
+                read.end -= back_length;
         }
+        return read;
     }
 
-    static void hard_clip_to_interval(SAMRecord& read, const Interval& interval)
+    static ClippedRead hard_clip_to_interval(ClippedRead read, const Interval& interval)
     {
-        auto& seq  = read.SEQ;
-        auto& qual = read.QUAL;
-
         const auto& [contig, begin, end] = interval;
-        assert(read.RNAME == contig);
+        assert(read.record->RNAME == contig);
 
-        auto alignment_begin = read.get_alignment_begin();
-        auto alignment_end   = read.get_alignment_end();
-        if (alignment_begin < begin)
-        {
-            auto clip_size = begin - alignment_begin;
-            if (clip_size > seq.size()) clip_size = seq.size();
-            seq  = seq. substr(clip_size);
-            qual = qual.substr(clip_size);
-        }
-        if (alignment_end > end)
-        {
-            auto clip_size = alignment_end - end;
-            seq  = seq. substr(0, seq. size()-clip_size);
-            qual = qual.substr(0, qual.size()-clip_size);
-        }
+        if (read.alignment_begin < begin)
+            read.begin += std::min(begin - read.alignment_begin, read.size());
+        if (read.alignment_end > end && read.alignment_end - end <= read.size())
+            read.end -= read.alignment_end - end;
+        return read;
     }
 };
 
@@ -1,40 +1,200 @@
 #pragma once
 
+#include <array>
+#include <tuple>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
 #include "../sam/sam.hpp"
+#include "../sam/sam_record_view.hpp"
+#include "../sam/bam_record_view.hpp"
 
 namespace hc
 {
 
 struct MappingQualityReadFilter
 {
+    static constexpr const char* NAME = "MappingQualityReadFilter";
     static constexpr std::uint16_t MIN_MAPPING_QUALITY_SCORE = 20;
-    bool operator()(const SAMRecord& record) const
+    template <typename Read>
+    bool operator()(const Read& record) const
     { return record.MAPQ < MIN_MAPPING_QUALITY_SCORE; }
 };
 
 struct DuplicateReadFilter
 {
-    bool operator()(const SAMRecord& record) const
+    static constexpr const char* NAME = "DuplicateReadFilter";
+    template <typename Read>
+    bool operator()(const Read& record) const
     { return record.DUPLICATE_READ(); }
 };
 
 struct SecondaryAlignmentReadFilter
 {
-    bool operator()(const SAMRecord& record) const
+    static constexpr const char* NAME = "SecondaryAlignmentReadFilter";
+    template <typename Read>
+    bool operator()(const Read& record) const
     { return record.SECONDARY_ALIGNMENT(); }
 };
 
 struct MinimumLengthReadFilter
 {
+    static constexpr const char* NAME = "MinimumLengthReadFilter";
     static constexpr std::size_t MINIMUM_READ_LENGTH_AFTER_TRIMMING = 10;
-    bool operator()(const SAMRecord& record) const
-    { return record.size() < MINIMUM_READ_LENGTH_AFTER_TRIMMING; }
+    template <typename Read>
+    bool operator()(const Read& read) const
+    { return read.size() < MINIMUM_READ_LENGTH_AFTER_TRIMMING; }
 };
 
 struct MateOnSameContigReadFilter
 {
-    bool operator()(const SAMRecord& record) const
+    static constexpr const char* NAME = "MateOnSameContigReadFilter";
+    template <typename Read>
+    bool operator()(const Read& record) const
     { return record.RNEXT != "="; }
 };
 
+/** SEQ must hold the bases the CIGAR reads, which SEQ "*" on a mapped read does not. */
+struct ReadLengthEqualsCigarLengthReadFilter
+{
+    static constexpr const char* NAME = "ReadLengthEqualsCigarLengthReadFilter";
+    bool operator()(const SAMRecord& record) const
+    { return record.SEQ.size() != record.CIGAR.get_read_length(); }
+    bool operator()(const SAMRecordView& record) const
+    { return record.SEQ.size() != record.get_cigar_read_length(); }
+    bool operator()(const BAMRecordView& record) const
+    { return record.l_seq != record.get_cigar_read_length(); }
+};
+
+struct SupplementaryAlignmentReadFilter
+{
+    static constexpr const char* NAME = "SupplementaryAlignmentReadFilter";
+    template <typename Read>
+    bool operator()(const Read& record) const
+    { return record.SUPPLEMENTARY_ALIGNMENT(); }
+};
+
+struct VendorQualityCheckReadFilter
+{
+    static constexpr const char* NAME = "VendorQualityCheckReadFilter";
+    template <typename Read>
+    bool operator()(const Read& record) const
+    { return record.READ_FAILS_VENDOR_QUALITY_CHECK(); }
+};
+
+/**
+ * Filters fused into one predicate: a read is tested against each enabled
+ * filter in order and rejected by the first that matches, which is charged
+ * for it. Filters are inlined at compile time and can be switched on or off
+ * by name at run time.
+ */
+template <typename... Filters>
+class ReadFilterChain
+{
+    static constexpr std::size_t N = sizeof...(Filters);
+    static constexpr const char* names[N] = {Filters::NAME...};
+
+    std::tuple<Filters...> filters;
+    std::array<bool, N> enabled;
+    std::array<std::size_t, N> rejected{};
+    std::size_t passed = 0;
+
+    template <typename Read, std::size_t... I>
+    std::size_t first_match(const Read& record, std::index_sequence<I...>) const
+    {
+        auto match = N;
+        ((enabled[I] && std::get<I>(filters)(record) && (match = I, true)) || ...);
+        return match;
+    }
+
+public:
+    ReadFilterChain() { enabled.fill(true); }
+
+    /** Bit i is set if the i-th filter is enabled. */
+    std::uint64_t enabled_mask() const
+    {
+        static_assert(N <= 64);
+        std::uint64_t mask = 0;
+        for (std::size_t i = 0; i < N; i++)
+            if (enabled[i]) mask |= std::uint64_t(1) << i;
+        return mask;
+    }
+
+    void set_enabled(std::string_view name, bool on)
+    {
+        for (std::size_t i = 0; i < N; i++)
+            if (name == names[i]) { enabled[i] = on; return; }
+        throw std::invalid_argument("Unknown read filter: " + std::string(name));
+    }
+
+    /** True if the read is rejected. */
+    template <typename Read>
+    bool operator()(const Read& record)
+    {
+        auto match = first_match(record, std::index_sequence_for<Filters...>{});
+        if (match == N) { passed++; return false; }
+        rejected[match]++;
+        return true;
+    }
+
+    /** The same filters, enabled alike, with no counts; for another task to fill and add back. */
+    ReadFilterChain without_counts() const
+    {
+        auto chain = *this;
+        chain.rejected.fill(0);
+        chain.passed = 0;
+        return chain;
+    }
+
+    /** Adds the counts of other, e.g. of a chain run by another task. */
+    ReadFilterChain& operator+=(const ReadFilterChain& other)
+    {
+        for (std::size_t i = 0; i < N; i++)
+            rejected[i] += other.rejected[i];
+        passed += other.passed;
+        return *this;
+    }
+
+    void report(std::ostream& os) const
+    {
+        std::size_t total = 0;
+        for (std::size_t i = 0; i < N; i++)
+        {
+            if (!enabled[i]) continue;
+            os << rejected[i] << " read(s) filtered by: " << names[i] << '\n';
+            total += rejected[i];
+        }
+        os << total << " read(s) filtered out of " << total + passed << '\n';
+    }
+};
+
+/** Read-intrinsic filters, applied once when reads are loaded; the last two are off unless requested. */
+using LoadReadFilters = ReadFilterChain<
+    MappingQualityReadFilter,
+    DuplicateReadFilter,
+    SecondaryAlignmentReadFilter,
+    MateOnSameContigReadFilter,
+    ReadLengthEqualsCigarLengthReadFilter,
+    SupplementaryAlignmentReadFilter,
+    VendorQualityCheckReadFilter>;
+
+/** Filters applied to the reads of a region after they are clipped to it. */
+using RegionReadFilters = ReadFilterChain<MinimumLengthReadFilter>;
+
+inline LoadReadFilters make_load_read_filters(const std::vector<std::string>& enable = {},
+                                              const std::vector<std::string>& disable = {})
+{
+    LoadReadFilters filters;
+    filters.set_enabled(SupplementaryAlignmentReadFilter::NAME, false);
+    filters.set_enabled(VendorQualityCheckReadFilter::NAME, false);
+    for (const auto& name : enable)
+        filters.set_enabled(name, true);
+    for (const auto& name : disable)
+        filters.set_enabled(name, false);
+    return filters;
+}
+
 } // hc
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <memory>
+#include <memory_resource>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+namespace hc
+{
+
+/**
+ * Monotonic memory for the short-lived containers of one region.
+ *
+ * Allocation bumps a pointer through a buffer and deallocation is a no-op;
+ * everything goes at once when the arena is destroyed. Buffers are recycled
+ * per thread: a finished region hands its buffer to the next region on the
+ * same thread, grown by whatever spilled to the heap up to MAX_SIZE, so
+ * regions of a steady workload stop calling malloc. A region started on a
+ * thread that is already inside one, as when a concurrent k-mer attempt
+ * runs on a waiting worker, takes a buffer of its own. At most MAX_SPARE
+ * buffers are kept per thread, so one deep window pins no more than
+ * MAX_SPARE * MAX_SIZE bytes on each thread for the rest of the run.
+ *
+ * The resource is not thread-safe: only the thread that owns the region may
+ * allocate from it.
+ */
+class RegionArena
+{
+    static constexpr std::size_t INITIAL_SIZE = 1 << 20;
+    static constexpr std::size_t MAX_SIZE = 8 << 20;
+    static constexpr std::size_t MAX_SPARE = 2;
+
+    struct Buffer
+    {
+        std::unique_ptr<std::byte[]> data;
+        std::size_t size = 0;
+    };
+
+    /** Heap memory taken once the buffer is full, counted to size the next buffer. */
+    struct Spill : std::pmr::memory_resource
+    {
+        std::size_t bytes = 0;
+
+        void* do_allocate(std::size_t n, std::size_t alignment) override
+        {
+            bytes += n;
+            return std::pmr::new_delete_resource()->allocate(n, alignment);
+        }
+
+        void do_deallocate(void* p, std::size_t n, std::size_t alignment) override
+        { std::pmr::new_delete_resource()->deallocate(p, n, alignment); }
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        { return this == &other; }
+    };
+
+    static inline thread_local std::vector<Buffer> spare;
+
+    static Buffer take()
+    {
+        if (spare.empty()) return {std::unique_ptr<std::byte[]>(new std::byte[INITIAL_SIZE]), INITIAL_SIZE};
+        auto buffer = std::move(spare.back());
+        spare.pop_back();
+        return buffer;
+    }
+
+    Buffer buffer;
+    Spill spill;
+    std::pmr::monotonic_buffer_resource arena;
+
+public:
+    RegionArena() : buffer(take()), arena(buffer.data.get(), buffer.size, &spill) {}
+
+    RegionArena(const RegionArena&) = delete;
+    RegionArena& operator=(const RegionArena&) = delete;
+
+    ~RegionArena()
+    {
+        arena.release();
+        if (spare.size() == MAX_SPARE) return;
+        if (spill.bytes > 0 && buffer.size < MAX_SIZE)
+        {
+            auto size = std::min(buffer.size + spill.bytes, MAX_SIZE);
+            buffer = {std::unique_ptr<std::byte[]>(new std::byte[size]), size};
+        }
+        spare.push_back(std::move(buffer));
+    }
+
+    std::pmr::memory_resource* resource() { return &arena; }
+};
+
+} // hc
@@ -0,0 +1,313 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <type_traits>
+
+namespace hc
+{
+
+/**
+ * Work-stealing task runtime shared by every level of parallelism.
+ *
+ * Each worker owns a deque: tasks spawned on a worker go to the back of its
+ * own deque and are popped from there (LIFO, cache-warm), while idle workers
+ * steal from the front of the others (FIFO, oldest and usually largest).
+ * Tasks submitted from outside the runtime go to a shared injection queue.
+ *
+ * Work that a thread outside the runtime is about to block on, such as the
+ * reader decoding ahead of the regions it feeds, goes to a priority lane
+ * instead: submit_priority(), and parallel_for() called from outside.
+ * Workers check the lane before the injection queue, and the blocked
+ * caller runs what is still queued there itself, see wait().
+ *
+ * parallel_for() lets a running task fan out finer-grained work. While it
+ * waits, the caller runs fanned-out tasks from its own deque or the
+ * priority lane or steals them from other workers, and sleeps when there
+ * are none. It never takes a task from the injection queue, whose tasks are
+ * whole regions that could hold the older region it is part of behind a
+ * newer one.
+ * With zero threads every task runs inline on the calling thread.
+ */
+class TaskRuntime
+{
+    using Task = std::function<void()>;
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    // fixed before any worker starts, unlike workers.size()
+    const std::size_t threads_count;
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues;  // one per worker, the injection queue, the priority lane
+    std::atomic<std::size_t> queued{0};
+    std::atomic<std::size_t> local_queued{0};  // the part of queued outside the injection queue
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cv;
+    // parallel_for() callers wait here for their calls or for tasks to steal
+    std::mutex wait_mutex;
+    std::condition_variable wait_cv;
+    bool stopping = false;
+
+    Clock::time_point started = Clock::now();
+    std::atomic<std::int64_t> idle_ns{0};
+
+    static inline thread_local const TaskRuntime* current = nullptr;
+    static inline thread_local std::size_t current_index = 0;
+
+    std::size_t injection() const { return threads_count; }
+    std::size_t priority() const { return threads_count + 1; }
+
+    std::size_t local_queue() const
+    { return current == this ? current_index : injection(); }
+
+    /** Where a task the caller is going to wait for goes. */
+    std::size_t waited_queue() const
+    { return current == this ? current_index : priority(); }
+
+    void wake_waiters()
+    {
+        {
+            std::lock_guard lock(wait_mutex);
+        }
+        wait_cv.notify_all();
+    }
+
+    void push(std::size_t i, Task task)
+    {
+        auto& queue = *queues[i];
+        queued++;
+        if (i != injection()) local_queued++;
+        {
+            std::lock_guard lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard lock(sleep_mutex);
+        }
+        sleep_cv.notify_one();
+        if (i != injection()) wake_waiters();
+    }
+
+    bool pop_back(std::size_t i, Task& task)
+    {
+        auto& queue = *queues[i];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        queued--;
+        if (i != injection()) local_queued--;
+        return true;
+    }
+
+    bool pop_front(std::size_t i, Task& task)
+    {
+        auto& queue = *queues[i];
+        std::lock_guard lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        queued--;
+        if (i != injection()) local_queued--;
+        return true;
+    }
+
+    /** Takes the oldest task of another worker, round-robin from self. */
+    bool steal(std::size_t self, Task& task)
+    {
+        for (std::size_t k = 1; k <= threads_count; k++)
+        {
+            auto victim = (self + k) % threads_count;
+            if (victim != self && pop_front(victim, task)) return true;
+        }
+        return false;
+    }
+
+    /** Own work first, then the priority lane, then the injection queue, then steal. */
+    bool find_task(std::size_t self, Task& task)
+    {
+        if (self < threads_count && pop_back(self, task)) return true;
+        if (pop_front(priority(), task)) return true;
+        if (pop_front(injection(), task)) return true;
+        return steal(self, task);
+    }
+
+    /** Own work first, then the priority lane, then steal; never the injection queue. */
+    bool find_local_task(std::size_t self, Task& task)
+    {
+        if (self < threads_count && pop_back(self, task)) return true;
+        if (pop_front(priority(), task)) return true;
+        return steal(self, task);
+    }
+
+    template <typename F>
+    auto submit_to(std::size_t i, F&& f)
+    {
+        using Result = std::invoke_result_t<std::decay_t<F>>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+        auto future = task->get_future();
+        if (threads_count == 0) (*task)();
+        else push(i, [task]{ (*task)(); });
+        return future;
+    }
+
+    void work(std::size_t index)
+    {
+        current = this;
+        current_index = index;
+        Task task;
+        while (true)
+        {
+            if (find_task(index, task))
+            {
+                task();
+                task = nullptr;
+                continue;
+            }
+            auto idle_begin = Clock::now();
+            std::unique_lock lock(sleep_mutex);
+            sleep_cv.wait(lock, [this]{ return stopping || queued > 0; });
+            idle_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - idle_begin).count();
+            if (stopping && queued == 0) return;
+        }
+    }
+
+public:
+    TaskRuntime(std::size_t threads = std::thread::hardware_concurrency())
+        : threads_count(threads)
+    {
+        for (std::size_t i = 0; i < threads + 2; i++)
+            queues.push_back(std::make_unique<Queue>());
+        for (std::size_t i = 0; i < threads; i++)
+            workers.emplace_back(&TaskRuntime::work, this, i);
+    }
+
+    TaskRuntime(const TaskRuntime&) = delete;
+    TaskRuntime& operator=(const TaskRuntime&) = delete;
+
+    /** Runs every queued task, then joins the workers. */
+    ~TaskRuntime()
+    {
+        {
+            std::lock_guard lock(sleep_mutex);
+            stopping = true;
+        }
+        sleep_cv.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    std::size_t size() const { return threads_count; }
+
+    /** Queues f; its result or exception is delivered through the returned future. */
+    template <typename F>
+    auto submit(F&& f)
+    { return submit_to(local_queue(), std::forward<F>(f)); }
+
+    /** Like submit(), for a task the caller will wait for with wait(); see the priority lane above. */
+    template <typename F>
+    auto submit_priority(F&& f)
+    { return submit_to(waited_queue(), std::forward<F>(f)); }
+
+    /**
+     * Waits for future, running the tasks still in the priority lane on the
+     * calling thread meanwhile, oldest first. Once the lane is empty the
+     * task behind future has been taken, so blocking on it is safe.
+     */
+    template <typename T>
+    void wait(std::future<T>& future)
+    {
+        Task task;
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready && pop_front(priority(), task))
+        {
+            task();
+            task = nullptr;
+        }
+        future.wait();
+    }
+
+    /**
+     * Calls f(i) for every i in [0, n) and returns when all calls are done.
+     * Calls may run on any worker; the caller runs the first and then helps
+     * with tasks in worker deques and the priority lane, where the calls go
+     * when the caller is outside the runtime, see find_local_task(). The
+     * first exception thrown is rethrown here.
+     */
+    template <typename F>
+    void parallel_for(std::size_t n, F&& f)
+    {
+        if (n == 0) return;
+        if (n == 1 || threads_count == 0)
+        {
+            for (std::size_t i = 0; i < n; i++) f(i);
+            return;
+        }
+
+        struct State
+        {
+            std::atomic<std::size_t> remaining;
+            std::mutex mutex;
+            std::exception_ptr error;
+        };
+        auto state = std::make_shared<State>();
+        state->remaining = n;
+        auto run = [this, state, &f](std::size_t i){
+            try { f(i); }
+            catch (...)
+            {
+                std::lock_guard lock(state->mutex);
+                if (!state->error) state->error = std::current_exception();
+            }
+            if (--state->remaining == 0) wake_waiters();
+        };
+
+        auto self = waited_queue();
+        for (std::size_t i = n - 1; i > 0; i--)
+            push(self, [run, i]{ run(i); });
+        run(0);
+
+        Task task;
+        while (state->remaining > 0)
+        {
+            if (find_local_task(self, task))
+            {
+                task();
+                task = nullptr;
+                continue;
+            }
+            // the remaining calls are running elsewhere, or were queued where only workers take them
+            auto idle_begin = Clock::now();
+            {
+                std::unique_lock lock(wait_mutex);
+                wait_cv.wait(lock, [&]{ return state->remaining == 0 || local_queued > 0; });
+            }
+            if (current == this)
+                idle_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - idle_begin).count();
+        }
+        if (state->error) std::rethrow_exception(state->error);
+    }
+
+    /** Total time workers spent waiting for work, and wall time times workers, in seconds. */
+    std::pair<double, double> idle_time() const
+    {
+        auto wall = std::chrono::duration<double>(Clock::now() - started).count();
+        return {idle_ns * 1e-9, wall * threads_count};
+    }
+};
+
+} // hc
@@ -6,9 +6,19 @@ int main(int argc, char* argv[])
     using namespace boost::program_options;
     options_description desc("USAGE: HaplotypeCaller [arguments]");
     desc.add_options()
-        ("input,I", value<std::string>(), "SAM file containing reads. Required.")
+        ("input,I", value<std::string>(), "SAM or BAM file containing reads. Required unless --read-shard is given.")
         ("output,O", value<std::string>(), "File to which variants should be written. Required.")
         ("reference,R", value<std::string>(), "Reference sequence file. Required.")
+        ("intervals,L", value<std::vector<std::string>>(), "One or more genomic intervals over which to operate: chr:begin-end, .bed, .interval_list or .intervals files. Repeatable.")
+        ("write-shard", value<std::string>(), "Write the filtered reads of --input to this read shard; calling then runs from it if --output is given.")
+        ("read-shard", value<std::string>(), "Read shard written by --write-shard, used instead of --input.")
+        ("threads", value<std::size_t>()->default_value(std::thread::hardware_concurrency()), "Number of worker threads for region and PairHMM tasks, and for BAM decompression or SAM parsing; 0 runs everything on the main thread.")
+        ("max-reads-per-alignment-start", value<std::size_t>()->default_value(1), "Maximum number of reads to retain per alignment start position; 0 disables downsampling.")
+        ("seed", value<std::uint64_t>()->default_value(0), "Seed for downsampling; runs with the same seed select the same reads.")
+        ("read-filter", value<std::vector<std::string>>(), "Enable an optional read filter: SupplementaryAlignmentReadFilter or VendorQualityCheckReadFilter. Repeatable.")
+        ("disable-read-filter", value<std::vector<std::string>>(), "Disable a read filter applied at load, by name. Repeatable.")
+        ("concurrent-kmer-sizes", bool_switch(), "When the first k-mer size fails in a region, try the larger ones concurrently instead of one after another.")
+        ("adaptive-pruning", bool_switch(), "Also prune assembly chains whose support is a small fraction of the coverage around them.")
         ("help,h", "Display the help message");
 
     variables_map vm;
@@ -20,9 +30,41 @@ int main(int argc, char* argv[])
         return 0;
     }
 
-    auto input = vm["input"].as<std::string>();
+    std::string input;
+    if (vm.count("read-shard"))
+        input = vm["read-shard"].as<std::string>();
+    else
+        input = vm["input"].as<std::string>();
+
+    std::vector<std::string> read_filters, disabled_read_filters;
+    if (vm.count("read-filter"))
+        read_filters = vm["read-filter"].as<std::vector<std::string>>();
+    if (vm.count("disable-read-filter"))
+        disabled_read_filters = vm["disable-read-filter"].as<std::vector<std::string>>();
+
+    if (vm.count("write-shard")) {
+        auto shard = vm["write-shard"].as<std::string>();
+        auto filters = hc::make_load_read_filters(read_filters, disabled_read_filters);
+        auto runtime = hc::TaskRuntime{vm["threads"].as<std::size_t>()};
+        hc::ReadShardWriter::write(*hc::open_read_source(input, &runtime), shard, filters);
+        std::cout << "Read filters applied while writing " << shard << ":\n";
+        filters.report(std::cout);
+        if (!vm.count("output")) return 0;
+        input = shard;
+    }
+
     auto output = vm["output"].as<std::string>();
     auto ref = vm["reference"].as<std::string>();
     
-    hc::HaplotypeCaller{input, output, ref}.do_work();
+    std::vector<hc::Interval> intervals;
+    if (vm.count("intervals"))
+        intervals = hc::IntervalUtils::load(vm["intervals"].as<std::vector<std::string>>());
+
+    auto threads = vm["threads"].as<std::size_t>();
+    auto max_reads_per_alignment_start = vm["max-reads-per-alignment-start"].as<std::size_t>();
+    auto seed = vm["seed"].as<std::uint64_t>();
+    auto concurrent_kmer_sizes = vm["concurrent-kmer-sizes"].as<bool>();
+    auto adaptive_pruning = vm["adaptive-pruning"].as<bool>();
+    hc::HaplotypeCaller{input, output, ref, intervals, threads, max_reads_per_alignment_start, seed,
+                        read_filters, disabled_read_filters, concurrent_kmer_sizes, adaptive_pruning}.do_work();
 }
\ No newline at end of file